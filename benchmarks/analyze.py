@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Percentiles of cyclictest -h histograms and comparison of two runs.
+
+Reads the histograms of cyclictest (PLAIN_KERNEL.txt, PATCHED_KERNEL.txt) and the latency.txt
+the controller writes on SIGUSR1, which has the same format.
+
+    analyze.py RUN                       percentiles and tail of every thread
+    analyze.py BASE NEW                  the same for both runs, fails if the tail of NEW is worse than BASE,
+                                         for all threads together or any single one
+    analyze.py RUN --limit p99.9=100     fails if a percentile of RUN is above the limit in us
+
+The exit code is 1 if a comparison or a limit failed, so it can be used in scripts which
+validate a kernel or configuration change.
+"""
+
+import argparse
+import sys
+
+PERCENTILES = [("p50", 0.5), ("p99", 0.99), ("p99.9", 0.999), ("p99.999", 0.99999)]
+
+
+class Run:
+    """Histogram of one cyclictest run, one column per thread, one bucket per us."""
+
+    def __init__(self, path):
+        self.path = path
+        self.buckets = []  # per bucket a list with the count of every thread
+        self.footer = {}  # "Min Latencies" etc., a list with the value of every thread
+        self._parse()
+        self.threads = len(self.buckets[0]) if self.buckets else len(self.footer.get("Max Latencies", []))
+
+    def _parse(self):
+        with open(self.path) as file:
+            for line in file:
+                line = line.strip()
+                if not line:
+                    continue
+                if line.startswith("#"):
+                    # footer lines are "# Name: value value ...", the overflow cycles are ignored
+                    name, colon, values = line[1:].partition(":")
+                    if colon and not name.strip().startswith("Thread"):
+                        try:
+                            self.footer[name.strip()] = [int(value) for value in values.split()]
+                        except ValueError:
+                            pass
+                    continue
+                fields = line.split()
+                if int(fields[0]) != len(self.buckets):
+                    raise ValueError("{}: bucket {} out of order".format(self.path, fields[0]))
+                self.buckets.append([int(value) for value in fields[1:]])
+
+        if not self.buckets:
+            raise ValueError("{}: no histogram".format(self.path))
+
+    @property
+    def size(self):
+        return len(self.buckets)
+
+    def thread(self, index):
+        """Latency of one thread."""
+        return Latency([bucket[index] for bucket in self.buckets], self._footer("Histogram Overflows", index),
+                       self._footer("Min Latencies", index), self._footer("Max Latencies", index))
+
+    def all(self):
+        """Latency of all threads together."""
+        threads = [self.thread(i) for i in range(self.threads)]
+        return Latency([sum(bucket) for bucket in self.buckets], sum(t.overflows for t in threads),
+                       min(t.min for t in threads), max(t.max for t in threads))
+
+    def _footer(self, name, index):
+        values = self.footer.get(name, [])
+        return values[index] if index < len(values) else 0
+
+
+class Latency:
+    """Distribution of the latencies of one thread or of several threads together."""
+
+    def __init__(self, buckets, overflows, min_latency, max_latency):
+        self.buckets = buckets
+        self.overflows = overflows
+        self.min = min_latency
+        self.max = max_latency
+        # the histogram plus the samples above it, "# Total" of cyclictest doesn't always match
+        self.samples = sum(buckets) + overflows
+
+    def percentile(self, fraction):
+        """Latency in us below which fraction of the samples are, None if that is above the histogram."""
+        needed = fraction * self.samples
+        count = 0
+        for latency, n in enumerate(self.buckets):
+            count += n
+            if count >= needed:
+                return latency
+        return None
+
+    def overflow_ratio(self):
+        """Part of the samples above the histogram."""
+        return self.overflows / self.samples if self.samples else 0.0
+
+    def tail_ratio(self, above):
+        """Part of the samples above latency us, overflows included."""
+        if not self.samples:
+            return 0.0
+        return (sum(self.buckets[above + 1:]) + self.overflows) / self.samples
+
+
+def format_percentile(value, size):
+    return ">{}".format(size - 1) if value is None else str(value)
+
+
+def print_run(run, tail):
+    print(run.path)
+    print("{:<8} {:>11} {:>5} {:>5}".format("thread", "samples", "min", "max")
+          + "".join(" {:>8}".format(name) for name, _ in PERCENTILES)
+          + " {:>10} {:>10}".format("overflow", ">{} us".format(tail)))
+
+    rows = [(str(i), run.thread(i)) for i in range(run.threads)] + [("all", run.all())]
+    for name, latency in rows:
+        print("{:<8} {:>11} {:>5} {:>5}".format(name, latency.samples, latency.min, latency.max)
+              + "".join(" {:>8}".format(format_percentile(latency.percentile(fraction), run.size))
+                        for _, fraction in PERCENTILES)
+              + " {:>10.2e} {:>10.2e}".format(latency.overflow_ratio(), latency.tail_ratio(tail)))
+    print()
+
+
+def worse(base, new, tolerance, slack):
+    """True if the latency new is more than tolerance percent plus slack us above base. Overflows
+    count as infinite, so a percentile which leaves the histogram always fails."""
+    if new is None:
+        return base is not None
+    if base is None:
+        return False
+    return new > base * (1 + tolerance / 100) + slack
+
+
+def verdict(bad, gated):
+    return "ok" if not bad else "FAIL" if gated else "worse"
+
+
+def compare_latency(name, a, b, base_size, new_size, gates, tolerance, slack, ratio):
+    """Compare the latency a of base with b of new, returns the number of failed checks. Checks
+    which are not in gates are only shown."""
+    failed = 0
+
+    print("{:<10} {:>8} {:>8}".format(name, "base", "new"))
+    checks = [(check, a.percentile(fraction), b.percentile(fraction)) for check, fraction in PERCENTILES]
+    checks.append(("max", a.max, b.max))
+    for check, old, now in checks:
+        bad = worse(old, now, tolerance, slack)
+        failed += bad and check in gates
+        print("{:<10} {:>8} {:>8}  {}".format(check, format_percentile(old, base_size),
+                                              format_percentile(now, new_size), verdict(bad, check in gates)))
+
+    # the overflows are rare, so a ratio is compared instead of a latency
+    bad = b.overflow_ratio() > a.overflow_ratio() * ratio and b.overflows > 0
+    failed += bad and "overflow" in gates
+    print("{:<10} {:>8.2e} {:>8.2e}  {}".format("overflow", a.overflow_ratio(), b.overflow_ratio(),
+                                                verdict(bad, "overflow" in gates)))
+    print()
+
+    return failed
+
+
+def compare(base, new, gates, tolerance, slack, ratio):
+    """Compare all threads together and every thread which is in both runs, returns the number of
+    failed checks. A thread which regressed fails the run even if the others hide it in "all"."""
+    series = [("all", base.all(), new.all())]
+    series += [("thread {}".format(i), base.thread(i), new.thread(i)) for i in range(min(base.threads, new.threads))]
+    if base.threads != new.threads:
+        print("only threads 0 to {} are in both runs\n".format(min(base.threads, new.threads) - 1))
+
+    failed = 0
+    regressed = []
+    for name, a, b in series:
+        count = compare_latency(name, a, b, base.size, new.size, gates, tolerance, slack, ratio)
+        failed += count
+        if count:
+            regressed.append(name)
+
+    if regressed:
+        print("regressed: {}\n".format(", ".join(regressed)))
+
+    return failed
+
+
+def check_limits(run, limits):
+    """Check the limits (name, us) against all threads of run, returns the number of failed checks."""
+    failed = 0
+    latency = run.all()
+    fractions = dict(PERCENTILES)
+
+    for name, limit in limits:
+        value = latency.max if name == "max" else latency.percentile(fractions[name])
+        bad = value is None or value > limit
+        failed += bad
+        print("{}: {} {} <= {} us  {}".format(run.path, name, format_percentile(value, run.size), limit,
+                                             "FAIL" if bad else "ok"))
+
+    return failed
+
+
+def parse_limit(text):
+    name, _, limit = text.partition("=")
+    if name not in dict(PERCENTILES) and name != "max":
+        raise argparse.ArgumentTypeError("unknown percentile {}".format(name))
+    return name, int(limit)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Percentiles of cyclictest -h histograms and comparison of two runs")
+    parser.add_argument("base", help="histogram of cyclictest -h or latency.txt of the controller")
+    parser.add_argument("new", nargs="?", help="run which is compared with base")
+    parser.add_argument("--check", default="p99.9,p99.999,max,overflow",
+                        help="comparisons which fail the run, a PREEMPT_RT kernel trades a higher median for a "
+                             "shorter tail (default p99.9,p99.999,max,overflow)")
+    parser.add_argument("--tolerance", type=float, default=10,
+                        help="percent a latency of new may be above base (default 10)")
+    parser.add_argument("--slack", type=int, default=2,
+                        help="us a latency of new may be above base on top of the tolerance (default 2)")
+    parser.add_argument("--overflow-ratio", type=float, default=2,
+                        help="factor the overflow ratio of new may be above base (default 2)")
+    parser.add_argument("--tail", type=int, default=100, help="latency in us for the tail column (default 100)")
+    parser.add_argument("--limit", type=parse_limit, action="append", default=[], metavar="PCT=US",
+                        help="fail if the percentile (p50, p99, p99.9, p99.999 or max) of every run is above US")
+    args = parser.parse_args()
+
+    runs = [Run(args.base)] + ([Run(args.new)] if args.new else [])
+    for run in runs:
+        print_run(run, args.tail)
+
+    failed = 0
+    if args.new:
+        failed += compare(runs[0], runs[1], args.check.split(","), args.tolerance, args.slack, args.overflow_ratio)
+    for run in runs if args.limit else []:
+        failed += check_limits(run, args.limit)
+
+    print("FAIL" if failed else "PASS")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,774 @@
+// Benchmarks of the GPIO and realtime library.
+//
+// Runs against the simulated GPIO block and the FIFO event source of ISR_BACKEND_CDEV (or the
+// simulated GPEDS register of ISR_BACKEND_REGISTER), so no hardware and no gpiosim process are
+// needed. Every benchmark prints one JSON line with the percentiles of its samples, e.g.
+//   {"bench":"gpio_set","unit":"ns","n":1000,"min":2,"p50":2,"p90":3,"p99":4,"max":9,"mean":2.4}
+// so the output can be compared against a baseline run.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+
+#include "gpio.h"
+#include "rtmem.h"
+
+#define BENCH_CPU 3
+#define BENCH_PRIO 80
+
+#define EDGE_PIN 18
+#define FREQ_PIN 17
+// synthetic signal of the humidity sensor
+#define FREQ_SIGNAL 3500.0
+#define FREQ_GATE_COUNT 20
+
+#define SET_CLR_BATCH 1000
+#define THREAD_START_COUNT 50
+#define REPLAY_RUNS 10
+
+static const char *eventDir = "/tmp/gpio_bench";
+static const char *replayFile;
+static int iterations = 1000;
+static bool dispatcher;
+static int backend = ISR_BACKEND_CDEV;
+// time of the last edge written by write_edge() in us
+static atomic_ullong lastEdge;
+static cpu_set_t cpuset;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t time) {
+    struct timespec ts = {(time_t) (time / 1000000000), (long) (time % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, int p) {
+    return sorted[(n - 1) * p / 100];
+}
+
+// Print the summary of the samples as one JSON line
+static void report(const char *name, const char *unit, double *samples, int n) {
+    double sum = 0;
+
+    if (n == 0) {
+        printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"n\":0}\n", name, unit);
+        return;
+    }
+
+    qsort(samples, n, sizeof samples[0], compare);
+    for (int i = 0; i < n; i++) sum += samples[i];
+
+    printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"n\":%d,\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+           "\"p99\":%.3f,\"max\":%.3f,\"mean\":%.3f}\n", name, unit, n, samples[0],
+           percentile(samples, n, 50), percentile(samples, n, 90), percentile(samples, n, 99),
+           samples[n - 1], sum / n);
+    fflush(stdout);
+}
+
+static void write_edge(int fd, int pin, uint64_t time, int level) {
+    atomic_store(&lastEdge, time / 1000);
+    if (backend == ISR_BACKEND_REGISTER) {
+        sim_drive_level(pin, level);
+    } else if (!sim_write_event(fd, time, level)) { /* ISR too slow, drop event */ }
+}
+
+static double *edgeSamples;
+static atomic_int edgeCount;
+
+static void edge_callback(int pin, int level) {
+    int i;
+
+    (void) pin;
+    if (level != GPIO_ON) return;
+
+    i = atomic_load(&edgeCount);
+    if (i >= iterations) return;
+    // the register backend only knows when it saw the edge, so measure from when it was written
+    edgeSamples[i] = (double) (get_clock_time() - atomic_load(&lastEdge));
+    atomic_store(&edgeCount, i + 1);
+}
+
+// Time from the kernel timestamp of an edge until its callback runs
+static int bench_edge_latency() {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    uint64_t next;
+    int fd;
+    int err;
+
+    if ((fd = sim_open_event_fifo(eventDir, EDGE_PIN)) < 0) return 1;
+
+    edgeSamples = calloc(iterations, sizeof edgeSamples[0]);
+    atomic_store(&edgeCount, 0);
+
+    activate(&activation);
+    if ((err = init_isr_func(EDGE_PIN, EDGE_RISING, edge_callback, &activation, &cpuset, BENCH_PRIO))) {
+        printf("init_isr_func failed: %d\n", err);
+        return 1;
+    }
+    // let the ISR thread reach poll()
+    usleep(10000);
+
+    // one edge per ms, so every edge wakes the ISR thread
+    next = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        next += 1000000;
+        sleep_until(next);
+        write_edge(fd, EDGE_PIN, now_ns(), 1);
+    }
+    usleep(10000);
+
+    report("edge_to_callback", "us", edgeSamples, atomic_load(&edgeCount));
+
+    deactivate(&activation);
+    del_isr_func(EDGE_PIN);
+    close(fd);
+    free(edgeSamples);
+
+    return 0;
+}
+
+static atomic_bool generating;
+
+// Square wave of FREQ_SIGNAL with exact timestamps into the event FIFO of FREQ_PIN
+static void *signal_generator(void *arg) {
+    int fd = *(int *) arg;
+    uint64_t halfPeriod = (uint64_t) (500000000.0 / FREQ_SIGNAL);
+    uint64_t next = now_ns();
+    int level = 0;
+
+    while (atomic_load(&generating)) {
+        next += halfPeriod;
+        sleep_until(next);
+        level = !level;
+        write_edge(fd, FREQ_PIN, next, level);
+    }
+
+    return NULL;
+}
+
+// Accuracy and gate overhead of both frequency measurement modes
+static int bench_freq() {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    double error[FREQ_GATE_COUNT], overhead[FREQ_GATE_COUNT];
+    double (*measure[])(int, useconds_t, activation_t *) = {read_input_freq, read_input_freq_reciprocal};
+    const char *name[][2] = {{"freq_error_gate", "freq_overhead_gate"},
+                             {"freq_error_reciprocal", "freq_overhead_reciprocal"}};
+    useconds_t gate[] = {DEFAULT_SAMPLE_TIME, RECIPROCAL_SAMPLE_TIME};
+    pthread_t generator;
+    uint64_t start;
+    double freq;
+    int fd;
+    int err;
+
+    if ((fd = sim_open_event_fifo(eventDir, FREQ_PIN)) < 0) return 1;
+
+    if ((err = init_isr_func(FREQ_PIN, EDGE_RISING, freq_counter, &activation, &cpuset, BENCH_PRIO))) {
+        printf("init_isr_func failed: %d\n", err);
+        return 1;
+    }
+
+    atomic_store(&generating, true);
+    pthread_create(&generator, NULL, signal_generator, &fd);
+    usleep(10000);
+
+    for (int mode = 0; mode < 2; mode++) {
+        for (int i = 0; i < FREQ_GATE_COUNT; i++) {
+            start = now_ns();
+            freq = measure[mode](FREQ_PIN, gate[mode], &activation);
+            // time spent in addition to the gate
+            overhead[i] = (double) (now_ns() - start) / 1000 - gate[mode];
+            error[i] = (freq - FREQ_SIGNAL) / FREQ_SIGNAL * 1e6;
+            if (error[i] < 0) error[i] = -error[i];
+            // the ISR thread stops after its next edge
+            usleep(2000);
+        }
+        report(name[mode][0], "ppm", error, FREQ_GATE_COUNT);
+        report(name[mode][1], "us", overhead, FREQ_GATE_COUNT);
+    }
+
+    atomic_store(&generating, false);
+    pthread_join(generator, NULL);
+    del_isr_func(FREQ_PIN);
+    close(fd);
+
+    return 0;
+}
+
+// Cost of one gpio_set() / gpio_clr() store and one gpio_read_bank() load of the (simulated) register block
+static int bench_set_clr() {
+    double *set = calloc(iterations, sizeof set[0]);
+    double *clr = calloc(iterations, sizeof clr[0]);
+    double *read = calloc(iterations, sizeof read[0]);
+    gpio_mask_t mask = GPIO_MASK(EDGE_PIN);
+    uint64_t start;
+
+    for (int i = 0; i < iterations; i++) {
+        start = now_ns();
+        for (int j = 0; j < SET_CLR_BATCH; j++) gpio_set(mask);
+        set[i] = (double) (now_ns() - start) / SET_CLR_BATCH;
+
+        start = now_ns();
+        for (int j = 0; j < SET_CLR_BATCH; j++) gpio_clr(mask);
+        clr[i] = (double) (now_ns() - start) / SET_CLR_BATCH;
+
+        start = now_ns();
+        for (int j = 0; j < SET_CLR_BATCH; j++) (void) gpio_read_bank(0);
+        read[i] = (double) (now_ns() - start) / SET_CLR_BATCH;
+    }
+
+    report("gpio_set", "ns", set, iterations);
+    report("gpio_clr", "ns", clr, iterations);
+    report("gpio_read", "ns", read, iterations);
+    free(set);
+    free(clr);
+    free(read);
+
+    return 0;
+}
+
+// Synthetic trace with iterations periods of FREQ_SIGNAL on FREQ_PIN
+static int write_synthetic_trace(const char *file) {
+    struct edge_trace_header header = {EDGE_TRACE_MAGIC, EDGE_TRACE_VERSION, sizeof(struct edge_trace_record), 0};
+    struct edge_trace_record record = {0, FREQ_PIN, 0};
+    FILE *fp;
+
+    if ((fp = fopen(file, "wb")) == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    fwrite(&header, sizeof header, 1, fp);
+    for (int i = 0; i < 2 * iterations; i++) {
+        record.time = (uint64_t) (i * 500000.0 / FREQ_SIGNAL);
+        record.level = !record.level;
+        fwrite(&record, sizeof record, 1, fp);
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static atomic_long replayedEdges;
+
+static void replay_callback(int pin, int level) {
+    (void) pin;
+    (void) level;
+    atomic_fetch_add_explicit(&replayedEdges, 1, memory_order_relaxed);
+}
+
+// Edges per second through the callbacks when a trace is replayed as fast as possible
+static int bench_replay() {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    double throughput[REPLAY_RUNS], cost[REPLAY_RUNS];
+    char path[255];
+    const char *file = replayFile;
+    uint64_t start;
+    long edges;
+    int err;
+
+    if (file == nullptr) {
+        snprintf(path, sizeof path, "%s/trace.bin", eventDir);
+        if (write_synthetic_trace(path) == -1) return 1;
+        file = path;
+    }
+
+    // every pin of a recorded trace is replayed
+    set_isr_backend(ISR_BACKEND_REPLAY, nullptr);
+    activate(&activation);
+    for (int pin = 0; pin < GPIO_COUNT; pin++) {
+        if ((err = init_isr_func(pin, EDGE_BOTH, replay_callback, &activation, &cpuset, BENCH_PRIO))) {
+            printf("init_isr_func failed: %d\n", err);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < REPLAY_RUNS; i++) {
+        start = now_ns();
+        edges = replay_edge_trace(file, 0);
+        if (edges <= 0) {
+            printf("replay: replay_edge_trace fed %ld edges from %s\n", edges, file);
+            return 1;
+        }
+        throughput[i] = (double) edges / ((double) (now_ns() - start) / 1e9);
+        cost[i] = (double) (now_ns() - start) / (double) edges;
+    }
+
+    report("replay_throughput", "edges/s", throughput, REPLAY_RUNS);
+    report("replay_edge_cost", "ns", cost, REPLAY_RUNS);
+
+    for (int pin = 0; pin < GPIO_COUNT; pin++) del_isr_func(pin);
+    set_isr_backend(backend, eventDir);
+
+    return 0;
+}
+
+#define REREGISTER_EDGES 20
+
+static atomic_long checkEdges;
+
+static void check_callback(int pin, int level) {
+    (void) pin;
+    if (level != GPIO_TIMEOUT) atomic_fetch_add(&checkEdges, 1);
+}
+
+// Write count alternating edges into the event FIFO, one per ms
+static void write_fifo_edges(int fd, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!sim_write_event(fd, now_ns(), i % 2 == 0)) { /* counted as missing */ }
+        usleep(1000);
+    }
+    usleep(10000);
+}
+
+// Feed REREGISTER_EDGES edges to FREQ_PIN registered with isrBackend, false if a callback is missing
+static bool feed_registered_pin(int isrBackend, int fd, const char *trace) {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    long expected = REREGISTER_EDGES, edges;
+    int err;
+
+    set_isr_backend(isrBackend, eventDir);
+    activate(&activation);
+    if ((err = init_isr_func(FREQ_PIN, EDGE_BOTH, check_callback, &activation, &cpuset, BENCH_PRIO))) {
+        printf("reregister: init_isr_func with backend %d failed: %d\n", isrBackend, err);
+        return false;
+    }
+    arm_isr(FREQ_PIN);
+    usleep(10000);
+    atomic_store(&checkEdges, 0);
+
+    if (isrBackend == ISR_BACKEND_REPLAY) {
+        expected = 2 * iterations;
+        if ((edges = replay_edge_trace(trace, 0)) != expected) {
+            printf("reregister: replay_edge_trace fed %ld of %ld edges from %s\n", edges, expected, trace);
+        }
+    } else if (isrBackend == ISR_BACKEND_REGISTER) {
+        // one edge per ms, slow enough for every poll to see each
+        for (int i = 0; i < REREGISTER_EDGES; i++) {
+            sim_drive_level(FREQ_PIN, i % 2 == 0);
+            usleep(1000);
+        }
+        usleep(10000);
+    } else {
+        write_fifo_edges(fd, REREGISTER_EDGES);
+    }
+
+    deactivate(&activation);
+    del_isr_func(FREQ_PIN);
+
+    if (atomic_load(&checkEdges) != expected) {
+        printf("reregister: backend %d called back %ld of %ld edges\n", isrBackend, atomic_load(&checkEdges), expected);
+        return false;
+    }
+
+    return true;
+}
+
+#define REGISTER_UNTOUCHED 0xa5a5a5a5u
+
+// Compare one raw word of the simulated block, false with a message if it differs
+static bool expect_word(const char *op, int offset, const char *name, uint32_t expected) {
+    uint32_t value = gpio.addr[offset];
+
+    if (value == expected) return true;
+    printf("registers: %s left %s = 0x%08x, expected 0x%08x\n", op, name, value, expected);
+    return false;
+}
+
+// gpio_set(), gpio_clr() and the reads have to hit the GPSET/GPCLR/GPLEV word of each bank
+// and leave the word of a bank without pins in the mask alone
+static int check_registers() {
+    gpio_mask_t both = GPIO_MASK(EDGE_PIN) | GPIO_MASK(40);
+    gpio_mask_t levels = 0x12345678u | (gpio_mask_t) 0x002abcdeu << 32;
+    bool ok = true;
+
+    for (int i = 0; i < 2; i++) {
+        gpio.addr[GPSET0 + i] = REGISTER_UNTOUCHED;
+        gpio.addr[GPCLR0 + i] = REGISTER_UNTOUCHED;
+    }
+    gpio_set(GPIO_MASK(EDGE_PIN));
+    ok &= expect_word("gpio_set(bank 0)", GPSET0, "GPSET0", 1u << EDGE_PIN);
+    ok &= expect_word("gpio_set(bank 0)", GPSET1, "GPSET1", REGISTER_UNTOUCHED);
+    gpio_set(GPIO_MASK(40));
+    ok &= expect_word("gpio_set(bank 1)", GPSET0, "GPSET0", 1u << EDGE_PIN);
+    ok &= expect_word("gpio_set(bank 1)", GPSET1, "GPSET1", 1u << (40 - 32));
+    ok &= expect_word("gpio_set()", GPCLR0, "GPCLR0", REGISTER_UNTOUCHED);
+    ok &= expect_word("gpio_set()", GPCLR1, "GPCLR1", REGISTER_UNTOUCHED);
+
+    gpio_clr(both);
+    ok &= expect_word("gpio_clr(both banks)", GPCLR0, "GPCLR0", 1u << EDGE_PIN);
+    ok &= expect_word("gpio_clr(both banks)", GPCLR1, "GPCLR1", 1u << (40 - 32));
+    ok &= expect_word("gpio_clr()", GPSET0, "GPSET0", 1u << EDGE_PIN);
+    ok &= expect_word("gpio_clr()", GPSET1, "GPSET1", 1u << (40 - 32));
+
+    gpio.addr[GPLEV0] = (uint32_t) levels;
+    gpio.addr[GPLEV1] = (uint32_t) (levels >> 32);
+    if (gpio_read_all() != levels || gpio_read_bank(1) != (uint32_t) (levels >> 32)
+        || gpio_read(40) != (int) ((levels >> 40) & 1) || gpio_read(EDGE_PIN) != (int) ((levels >> EDGE_PIN) & 1)) {
+        printf("registers: gpio_read_all() = 0x%016llx, expected 0x%016llx\n",
+               (unsigned long long) gpio_read_all(), (unsigned long long) levels);
+        ok = false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        gpio.addr[GPSET0 + i] = 0;
+        gpio.addr[GPCLR0 + i] = 0;
+        gpio.addr[GPLEV0 + i] = 0;
+    }
+
+    printf("registers: %s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static uint64_t *orderTimes;
+static int *orderLevels;
+static atomic_int orderCount;
+
+static void order_callback(int pin, int level) {
+    int i;
+
+    if (level == GPIO_TIMEOUT) return;
+
+    i = atomic_fetch_add(&orderCount, 1);
+    if (i >= iterations) return;
+    orderTimes[i] = get_isr_event_time(pin);
+    orderLevels[i] = level;
+}
+
+// Every edge of the FIFO source has to reach the callback exactly once, in order, with its
+// level and timestamp
+static int check_order() {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    uint64_t *written;
+    int count, failed = -1;
+    int fd, err;
+
+    if ((fd = sim_open_event_fifo(eventDir, FREQ_PIN)) < 0) return 1;
+
+    written = calloc(iterations, sizeof written[0]);
+    orderTimes = calloc(iterations, sizeof orderTimes[0]);
+    orderLevels = calloc(iterations, sizeof orderLevels[0]);
+    atomic_store(&orderCount, 0);
+
+    set_isr_backend(ISR_BACKEND_CDEV, eventDir);
+    activate(&activation);
+    if ((err = init_isr_func(FREQ_PIN, EDGE_BOTH, order_callback, &activation, &cpuset, BENCH_PRIO))) {
+        printf("order: init_isr_func failed: %d\n", err);
+        return 1;
+    }
+    arm_isr(FREQ_PIN);
+    usleep(10000);
+
+    // one edge per ms, rising first
+    for (int i = 0; i < iterations; i++) {
+        written[i] = now_ns();
+        if (!sim_write_event(fd, written[i], i % 2 == 0)) { /* counted as missing */ }
+        usleep(1000);
+    }
+    usleep(10000);
+
+    deactivate(&activation);
+    del_isr_func(FREQ_PIN);
+    set_isr_backend(backend, eventDir);
+    close(fd);
+
+    count = atomic_load(&orderCount);
+    for (int i = 0; i < count && i < iterations && failed < 0; i++) {
+        if (orderLevels[i] != (i % 2 == 0 ? GPIO_ON : GPIO_OFF) || orderTimes[i] != written[i] / 1000) failed = i;
+    }
+
+    if (count != iterations) {
+        printf("order: %d callbacks for %d edges\n", count, iterations);
+    } else if (failed >= 0) {
+        printf("order: callback %d got level %d at %llu us, edge %d was level %d at %llu us\n", failed,
+               orderLevels[failed], (unsigned long long) orderTimes[failed], failed, failed % 2 == 0,
+               (unsigned long long) (written[failed] / 1000));
+    }
+    free(written);
+    free(orderTimes);
+    free(orderLevels);
+
+    if (count != iterations || failed >= 0) {
+        printf("order: FAIL\n");
+        return 1;
+    }
+
+    printf("order: ok\n");
+    return 0;
+}
+
+// Register, delete and register FREQ_PIN again with every backend, each registration has to
+// deliver all of its edges whatever the previous one left behind
+static int check_reregister() {
+    int backends[] = {ISR_BACKEND_CDEV, ISR_BACKEND_REPLAY, ISR_BACKEND_REGISTER, ISR_BACKEND_CDEV,
+                      ISR_BACKEND_REGISTER, ISR_BACKEND_REPLAY};
+    char trace[255];
+    bool ok = true;
+    int fd;
+
+    if ((fd = sim_open_event_fifo(eventDir, FREQ_PIN)) < 0) return 1;
+    snprintf(trace, sizeof trace, "%s/trace.bin", eventDir);
+    if (write_synthetic_trace(trace) == -1) return 1;
+
+    for (size_t i = 0; i < sizeof backends / sizeof backends[0]; i++) {
+        ok &= feed_registered_pin(backends[i], fd, trace);
+    }
+    set_isr_backend(backend, eventDir);
+    close(fd);
+
+    printf("reregister: %s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+// Edges of a deactivated pin must not reach its callback, neither while it is inactive nor
+// queued up for its next activation
+static int check_inactive() {
+    activation_t activation = ACTIVATION_INITIALIZER;
+    long active, inactive, again;
+    int fd, err;
+
+    if ((fd = sim_open_event_fifo(eventDir, FREQ_PIN)) < 0) return 1;
+    set_isr_backend(ISR_BACKEND_CDEV, eventDir);
+    if ((err = init_isr_func(FREQ_PIN, EDGE_BOTH, check_callback, &activation, &cpuset, BENCH_PRIO))) {
+        printf("inactive: init_isr_func failed: %d\n", err);
+        return 1;
+    }
+
+    atomic_store(&checkEdges, 0);
+    activate(&activation);
+    arm_isr(FREQ_PIN);
+    usleep(10000);
+    write_fifo_edges(fd, REREGISTER_EDGES);
+    active = atomic_exchange(&checkEdges, 0);
+
+    deactivate(&activation);
+    usleep(10000);
+    write_fifo_edges(fd, REREGISTER_EDGES);
+    inactive = atomic_exchange(&checkEdges, 0);
+
+    activate(&activation);
+    arm_isr(FREQ_PIN);
+    usleep(10000);
+    write_fifo_edges(fd, REREGISTER_EDGES);
+    again = atomic_load(&checkEdges);
+
+    deactivate(&activation);
+    del_isr_func(FREQ_PIN);
+    set_isr_backend(backend, eventDir);
+    close(fd);
+
+    if (active != REREGISTER_EDGES || inactive != 0 || again != REREGISTER_EDGES) {
+        printf("inactive: %ld, %ld and %ld callbacks for %d edges while active, inactive and active again\n",
+               active, inactive, again, REREGISTER_EDGES);
+        printf("inactive: FAIL\n");
+        return 1;
+    }
+
+    printf("inactive: ok\n");
+    return 0;
+}
+
+static uint64_t threadEntered;
+
+static void thread_entry() {
+    threadEntered = now_ns();
+}
+
+// Time from start_realtime_thread() until the thread function runs
+static int bench_thread_start() {
+    double samples[THREAD_START_COUNT];
+    thread_t thread = {thread_entry, nullptr};
+    pthread_t pthread;
+    uint64_t start;
+    int err;
+
+    for (int i = 0; i < THREAD_START_COUNT; i++) {
+        start = now_ns();
+        if ((err = start_realtime_thread(&pthread, &thread, &cpuset, BENCH_PRIO))) {
+            printf("start_realtime_thread failed: %d\n", err);
+            return 1;
+        }
+        pthread_join(pthread, NULL);
+        samples[i] = (double) (threadEntered - start) / 1000;
+    }
+
+    report("thread_start", "us", samples, THREAD_START_COUNT);
+
+    return 0;
+}
+
+static activation_t wakeActivation = ACTIVATION_INITIALIZER;
+static pthread_mutex_t wakeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+static bool wakeFlag;
+static atomic_ullong wakeSignalled; // ns
+static double *wakeSamples;
+static atomic_int wakeCount;
+
+static void record_wakeup() {
+    int i = atomic_load(&wakeCount);
+
+    if (i < iterations) wakeSamples[i] = (double) (now_ns() - atomic_load(&wakeSignalled)) / 1000;
+    atomic_store(&wakeCount, i + 1);
+}
+
+static void activation_waiter() {
+    while (atomic_load(&wakeCount) < iterations) {
+        take_activation(&wakeActivation);
+        record_wakeup();
+    }
+}
+
+// the mutex and condition variable pair which activation_t replaced, as baseline
+static void condvar_waiter() {
+    while (atomic_load(&wakeCount) < iterations) {
+        pthread_mutex_lock(&wakeMutex);
+        while (!wakeFlag) pthread_cond_wait(&wakeCond, &wakeMutex);
+        wakeFlag = false;
+        pthread_mutex_unlock(&wakeMutex);
+        record_wakeup();
+    }
+}
+
+// Time from the activation by this thread until the RT thread runs, like the release of a task
+static int bench_wakeup() {
+    thread_t threads[] = {{activation_waiter, nullptr}, {condvar_waiter, nullptr}};
+    const char *names[] = {"wakeup_activation", "wakeup_condvar"};
+    pthread_t pthread;
+    uint64_t next;
+    int err;
+
+    wakeSamples = calloc(iterations, sizeof wakeSamples[0]);
+
+    for (int mode = 0; mode < 2; mode++) {
+        atomic_store(&wakeCount, 0);
+        if ((err = start_realtime_thread(&pthread, &threads[mode], &cpuset, BENCH_PRIO))) {
+            printf("start_realtime_thread failed: %d\n", err);
+            return 1;
+        }
+        usleep(10000);
+
+        // one activation per ms, the waiter always sleeps when it is activated
+        next = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            next += 1000000;
+            sleep_until(next);
+            atomic_store(&wakeSignalled, now_ns());
+            if (mode == 0) {
+                activate(&wakeActivation);
+            } else {
+                pthread_mutex_lock(&wakeMutex);
+                wakeFlag = true;
+                pthread_cond_signal(&wakeCond);
+                pthread_mutex_unlock(&wakeMutex);
+            }
+        }
+        pthread_join(pthread, NULL);
+
+        report(names[mode], "us", wakeSamples, atomic_load(&wakeCount));
+    }
+    free(wakeSamples);
+
+    return 0;
+}
+
+static void usage() {
+    printf("usage: gpio_bench [-n iterations] [-d dir] [-D | -R] [-t trace] [edge|freq|setclr|thread|replay|wakeup|registers|order|reregister|inactive]...\n"
+           "\n"
+           "  -n iterations  samples per benchmark (default 1000)\n"
+           "  -d dir         directory for the simulated GPIO block and event FIFOs\n"
+           "                 (default /tmp/gpio_bench)\n"
+           "  -D             handle the edges with the ISR dispatcher\n"
+           "  -R             detect the edges with ISR_BACKEND_REGISTER in the simulated block\n"
+           "  -t trace       edge trace for replay (default a synthetic signal of 2 * iterations edges)\n"
+           "registers, order, reregister and inactive are checks, they print ok or FAIL instead of numbers and fail the run.\n"
+           "Without names all benchmarks are run.\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct {
+        const char *name;
+        int (*run)();
+    } benches[] = {{"edge",   bench_edge_latency},
+                   {"freq",   bench_freq},
+                   {"setclr", bench_set_clr},
+                   {"thread", bench_thread_start},
+                   {"replay", bench_replay},
+                   {"wakeup", bench_wakeup},
+                   {"registers", check_registers},
+                   {"order", check_order},
+                   {"reregister", check_reregister},
+                   {"inactive", check_inactive}};
+    int count = sizeof benches / sizeof benches[0];
+    char path[255];
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:DRt:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'd':
+                eventDir = optarg;
+                break;
+            case 'D':
+                dispatcher = true;
+                break;
+            case 'R':
+                backend = ISR_BACKEND_REGISTER;
+                break;
+            case 't':
+                replayFile = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage();
+        return 1;
+    }
+
+    if (mkdir(eventDir, 0777) == -1 && errno != EEXIST) {
+        perror("mkdir");
+        return 1;
+    }
+    snprintf(path, sizeof path, "%s/gpio-sim", eventDir);
+    if (map_sim_peripherals(path) == -1) return 1;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(BENCH_CPU % sysconf(_SC_NPROCESSORS_ONLN), &cpuset);
+    set_isr_backend(backend, eventDir);
+
+    if (rtmem_init(RTMEM_HEAP_PREFAULT) == -1) {
+        printf("Failed to prepare memory\n");
+    }
+
+    if (dispatcher && start_isr_dispatcher(&cpuset, BENCH_PRIO)) {
+        printf("Failed to start ISR dispatcher\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        bool selected = optind >= argc;
+
+        for (int j = optind; j < argc; j++) {
+            if (strcmp(argv[j], benches[i].name) == 0) selected = true;
+        }
+        if (selected) failed |= benches[i].run();
+    }
+
+    unmap_peripherals();
+
+    return failed;
+}
@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "cyclic.h"
+#include "rtmem.h"
+
+void cyclic_task_done(cyclic_task_t *task) {
+    uint64_t response = get_clock_time() - atomic_load(&task->release);
+
+    if (response > task->deadline) atomic_fetch_add(&task->deadlineMisses, 1);
+    if (response > atomic_load(&task->maxResponse)) atomic_store(&task->maxResponse, response);
+    if (task->stats != nullptr) stats_hist(task->stats->response, response);
+
+    atomic_store(&task->pending, false);
+}
+
+static void release_task(cyclic_task_t *task, uint64_t time) {
+    // don't stack activations of a task which is still running
+    if (atomic_load(&task->pending)) {
+        atomic_fetch_add(&task->overruns, 1);
+        return;
+    }
+
+    atomic_store(&task->release, time);
+    atomic_store(&task->pending, true);
+    atomic_fetch_add(&task->releases, 1);
+
+    if (task->activation != nullptr) {
+        activate(task->activation);
+    } else {
+        task->func();
+        cyclic_task_done(task);
+    }
+}
+
+// Name the stats slots of the tasks, tasks beyond STATS_TASKS are not published
+static void attach_stats(cyclic_table_t *table) {
+    int count = table->count < STATS_TASKS ? table->count : STATS_TASKS;
+
+    if (gpioStats == nullptr) return;
+
+    for (int i = 0; i < count; i++) {
+        table->tasks[i].stats = &gpioStats->tasks[i];
+        strncpy(table->tasks[i].stats->name, table->tasks[i].name, STATS_NAME_LEN - 1);
+    }
+    atomic_store(&gpioStats->taskCount, count);
+}
+
+// Copy the counters of all tasks into their slots, the executive is the only writer
+static void publish_stats(cyclic_table_t *table) {
+    for (int i = 0; i < table->count; i++) {
+        cyclic_task_t *task = &table->tasks[i];
+        stats_task_t *stats = task->stats;
+        if (stats == nullptr) continue;
+
+        stats_write_begin(&stats->seq);
+        stats->releases = atomic_load_explicit(&task->releases, memory_order_relaxed);
+        stats->overruns = atomic_load_explicit(&task->overruns, memory_order_relaxed);
+        stats->deadlineMisses = atomic_load_explicit(&task->deadlineMisses, memory_order_relaxed);
+        stats->maxResponse = atomic_load_explicit(&task->maxResponse, memory_order_relaxed);
+        stats_write_end(&stats->seq);
+    }
+}
+
+void cyclic_executive(cyclic_table_t *table) {
+    struct timespec wakeup;
+    uint64_t start = get_clock_time();
+    uint64_t next, time;
+    int err;
+
+    for (int i = 0; i < table->count; i++) {
+        table->tasks[i].next = start + table->tasks[i].offset;
+    }
+    attach_stats(table);
+
+    while (1) {
+        next = UINT64_MAX;
+        for (int i = 0; i < table->count; i++) {
+            if (table->tasks[i].next < next) next = table->tasks[i].next;
+        }
+
+        wakeup.tv_sec = (time_t) (next / 1000000);
+        wakeup.tv_nsec = (long) (next % 1000000) * 1000;
+        // any other error returns at once, retrying it would spin at the priority of the executive
+        while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL)) == EINTR);
+        if (err != 0) {
+            RTLOG("cyclic executive: clock_nanosleep failed with error %d, stopping\n", err);
+            return;
+        }
+        latency_record(next);
+        RTMEM_CHECK();
+
+        time = get_clock_time();
+        for (int i = 0; i < table->count; i++) {
+            cyclic_task_t *task = &table->tasks[i];
+            if (task->next > time) continue;
+
+            release_task(task, task->next);
+            task->next += task->period;
+
+            // releases which already passed are lost, the task stays in its phase
+            while (task->next <= time) {
+                atomic_fetch_add(&task->overruns, 1);
+                task->next += task->period;
+            }
+        }
+        publish_stats(table);
+        exec_time_record();
+    }
+}
+
+void cyclic_report(cyclic_table_t *table) {
+    for (int i = 0; i < table->count; i++) {
+        cyclic_task_t *task = &table->tasks[i];
+        RTLOG("%s: %u releases, %u overruns, %u deadline misses, max response %llu us\n", task->name,
+              atomic_load(&task->releases), atomic_load(&task->overruns),
+              atomic_load(&task->deadlineMisses), (unsigned long long) atomic_load(&task->maxResponse));
+    }
+}
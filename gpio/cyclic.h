@@ -0,0 +1,51 @@
+#ifndef GPIO_CYCLIC_H
+#define GPIO_CYCLIC_H
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "realtime.h"
+#include "stats.h"
+
+// One entry of the task table. All times are in us.
+// A task is either called by the executive (func) or activated through activation, in which
+// case the task thread has to call cyclic_task_done() when it is finished.
+typedef struct {
+    const char *name; // string literal, used for the report
+    callbk_t func;
+    activation_t *activation;
+    uint64_t period;
+    uint64_t offset; // first release after start of the executive
+    uint64_t deadline; // relative to the release
+
+    uint64_t next; // next release (monotonic)
+    atomic_ullong release; // last release
+    atomic_bool pending; // released and not done yet
+    atomic_uint releases;
+    atomic_uint overruns; // releases which were skipped because the task was still pending or late
+    atomic_uint deadlineMisses;
+    atomic_ullong maxResponse; // max time from release to done
+    stats_task_t *stats; // slot in the stats segment, set by the executive
+} cyclic_task_t;
+
+typedef struct {
+    cyclic_task_t *tasks;
+    int count; // tasks which are released at the same time run in table order
+} cyclic_table_t;
+
+// Executive loop, start it with start_realtime_thread() and the table as argument.
+// Releases are computed from absolute times, so the work of the tasks doesn't shift the periods.
+// The counters of the tasks are published in gpioStats after every wakeup. Only returns if the
+// timer fails.
+extern void cyclic_executive(cyclic_table_t *table);
+
+// Mark the current activation of a cond task as finished and account its response time
+extern void cyclic_task_done(cyclic_task_t *task);
+
+// Log the release, overrun and deadline miss counters of all tasks
+extern void cyclic_report(cyclic_table_t *table);
+
+#endif //GPIO_CYCLIC_H
@@ -0,0 +1,141 @@
+#ifndef GPIO_EDGE_RING_H
+#define GPIO_EDGE_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// number of events per ring, must be a power of two
+#define EDGE_RING_SIZE      1024
+#define EDGE_RING_MASK      (EDGE_RING_SIZE - 1)
+
+#define CACHE_LINE_SIZE     64
+
+// Indices of a wait-free single-producer/single-consumer ring, the slots are kept by the
+// embedding struct (edge_ring_t, the rings of rtlog.c) and size is their count, a power of two.
+// The producer and the consumer each own one cache line with their index and a cached copy of
+// the other index, so a push or pop only touches the other side's line when the cached index
+// says the ring is full / empty.
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head; // next slot to write, counts all published elements
+    unsigned int cachedTail;
+    atomic_uint dropped; // elements lost because the ring was full
+
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail; // next slot to read
+    unsigned int cachedHead;
+} spsc_ring_t;
+
+// Producer: slot for the next element, false (and the element counted as dropped) if the ring
+// is full. The element is visible to the consumer after spsc_ring_publish().
+static inline bool spsc_ring_reserve(spsc_ring_t *ring, unsigned int size, unsigned int *slot) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - ring->cachedTail >= size) {
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cachedTail >= size) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return false;
+        }
+    }
+
+    *slot = head & (size - 1);
+    return true;
+}
+
+// Producer: publish the element written into the reserved slot
+static inline void spsc_ring_publish(spsc_ring_t *ring) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Consumer: slot of the oldest element, false if the ring is empty. The slot stays valid
+// until spsc_ring_release().
+static inline bool spsc_ring_peek(spsc_ring_t *ring, unsigned int size, unsigned int *slot) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == ring->cachedHead) {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->cachedHead) return false;
+    }
+
+    *slot = tail & (size - 1);
+    return true;
+}
+
+// Consumer: hand the slot of the oldest element back to the producer
+static inline void spsc_ring_release(spsc_ring_t *ring) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Consumer: discard all elements published so far
+static inline void spsc_ring_flush(spsc_ring_t *ring) {
+    ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+    atomic_store_explicit(&ring->tail, ring->cachedHead, memory_order_release);
+}
+
+// Any thread: number of elements seen by the producer (published + dropped)
+static inline unsigned int spsc_ring_count(spsc_ring_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire)
+           + atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
+
+// Any thread: number of elements lost because the ring was full
+static inline unsigned int spsc_ring_dropped(spsc_ring_t *ring) {
+    return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
+
+typedef struct {
+    uint64_t time; // event time in us (monotonic)
+    uint16_t pin;
+    uint16_t level;
+} edge_event_t;
+
+// Ring of the edge events of one pin, the producer is the ISR thread
+typedef struct {
+    spsc_ring_t ring;
+    _Alignas(CACHE_LINE_SIZE) edge_event_t events[EDGE_RING_SIZE];
+} edge_ring_t;
+
+static inline void edge_ring_init(edge_ring_t *ring) {
+    memset(ring, 0, sizeof *ring);
+}
+
+// Producer: publish one event. Never blocks, counts the event as dropped if the ring is full.
+static inline bool edge_ring_push(edge_ring_t *ring, uint64_t time, unsigned int pin, int level) {
+    unsigned int slot;
+
+    if (!spsc_ring_reserve(&ring->ring, EDGE_RING_SIZE, &slot)) return false;
+
+    ring->events[slot] = (edge_event_t) {time, pin, level};
+    spsc_ring_publish(&ring->ring);
+
+    return true;
+}
+
+// Consumer: take the oldest event, false if the ring is empty
+static inline bool edge_ring_pop(edge_ring_t *ring, edge_event_t *event) {
+    unsigned int slot;
+
+    if (!spsc_ring_peek(&ring->ring, EDGE_RING_SIZE, &slot)) return false;
+
+    *event = ring->events[slot];
+    spsc_ring_release(&ring->ring);
+
+    return true;
+}
+
+// Consumer: discard all events published so far
+static inline void edge_ring_flush(edge_ring_t *ring) {
+    spsc_ring_flush(&ring->ring);
+}
+
+// Any thread: number of edges seen by the producer (published + dropped)
+static inline unsigned int edge_ring_count(edge_ring_t *ring) {
+    return spsc_ring_count(&ring->ring);
+}
+
+#endif //GPIO_EDGE_RING_H
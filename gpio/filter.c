@@ -0,0 +1,68 @@
+#include "filter.h"
+
+fixed_t filter_median(const fixed_t *gates, int count) {
+    fixed_t sorted[FILTER_MAX_MEDIAN];
+    fixed_t value;
+    int j;
+
+    if (count > FILTER_MAX_MEDIAN) count = FILTER_MAX_MEDIAN;
+
+    // insertion sort, a measurement has only a few gates
+    for (int i = 0; i < count; i++) {
+        value = gates[i];
+        for (j = i; j > 0 && sorted[j - 1] > value; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = value;
+    }
+
+    return sorted[count / 2];
+}
+
+void filter_init(sensor_filter_t *filter, const filter_config_t *config) {
+    *filter = (sensor_filter_t) {config};
+}
+
+void filter_restart(sensor_filter_t *filter) {
+    filter->restart = true;
+}
+
+fixed_t filter_push(sensor_filter_t *filter, const fixed_t *gates, int count) {
+    const filter_config_t *config = filter->config;
+    fixed_t current = filter_median(gates, count);
+    fixed_t deviation;
+
+    if (!filter->valid || filter->restart) {
+        filter->average = current;
+        filter->valid = true;
+        filter->restart = false;
+        filter->outliers = 0;
+        return filter->average;
+    }
+
+    deviation = current > filter->average ? current - filter->average : filter->average - current;
+    if (deviation * 100 > filter->average * config->outlierPercent) {
+        // reject single outliers
+        if (++filter->outliers <= config->outlierLimit) return filter->average;
+
+        // but follow a level which stays there, the old average would reject it forever
+        filter->outliers = 0;
+        filter->average = current;
+        return filter->average;
+    }
+    filter->outliers = 0;
+
+    filter->average += (current - filter->average) >> config->emaShift;
+
+    return filter->average;
+}
+
+bool filter_is_dry(sensor_filter_t *filter, long arid, long humid) {
+    if (!filter->valid) return false;
+
+    if (filter->average > TO_FIXED(arid)) {
+        filter->dry = true;
+    } else if (filter->average < TO_FIXED(humid)) {
+        filter->dry = false;
+    }
+
+    return filter->dry;
+}
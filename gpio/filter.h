@@ -0,0 +1,53 @@
+#ifndef GPIO_FILTER_H
+#define GPIO_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// max length of the median window
+#define FILTER_MAX_MEDIAN   9
+// fractional bits of the fixed point samples
+#define FILTER_FRAC_BITS    8
+
+typedef int64_t fixed_t;
+
+#define TO_FIXED(x)     ((fixed_t) ((x) * (1 << FILTER_FRAC_BITS)))
+#define FROM_FIXED(x)   ((double) (x) / (1 << FILTER_FRAC_BITS))
+
+// Parameters of a filter, may be shared by several filters
+typedef struct {
+    int medianLength; // gates per measurement, odd, up to FILTER_MAX_MEDIAN
+    int emaShift; // weight of a new measurement in the moving average is 1 / 2^emaShift
+    int outlierPercent; // measurements which differ more from the average are rejected
+    int outlierLimit; // consecutive rejected measurements which are accepted as a real change
+} filter_config_t;
+
+// Streaming filter of one sensor: median of the gates of a measurement -> outlier rejection ->
+// moving average -> hysteresis. Everything lives in the struct, pushing never allocates.
+typedef struct {
+    const filter_config_t *config;
+    int outliers; // consecutive rejected measurements
+    fixed_t average;
+    bool valid; // average holds at least one measurement
+    bool restart; // the next measurement replaces the average
+    bool dry; // decision of filter_is_dry()
+} sensor_filter_t;
+
+// Clear the filter, it decides nothing until the first measurement
+extern void filter_init(sensor_filter_t *filter, const filter_config_t *config);
+
+// Start the moving average again with the next measurement, e.g. after watering. The next
+// measurement is not checked for outliers and the dry decision is kept, so the hysteresis holds.
+extern void filter_restart(sensor_filter_t *filter);
+
+// Median of count (up to FILTER_MAX_MEDIAN) gates
+extern fixed_t filter_median(const fixed_t *gates, int count);
+
+// Add a measurement of count gates taken right after each other, returns the filtered value
+extern fixed_t filter_push(sensor_filter_t *filter, const fixed_t *gates, int count);
+
+// Hysteresis between arid and humid on the filtered value: dry above arid, wet again below
+// humid. Always false before the first measurement.
+extern bool filter_is_dry(sensor_filter_t *filter, long arid, long humid);
+
+#endif //GPIO_FILTER_H
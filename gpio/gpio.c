@@ -1,14 +1,30 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/gpio.h>
 #include "gpio.h"
+#include "rtmem.h"
+#include "stats.h"
 
-#define GPIO_COUNT 50
+// max events consumed by one read() in the ISR_BACKEND_CDEV thread
+#define CDEV_EVENT_BATCH 16
+
+// timer wheel of the dispatcher, a timeout is checked every DISPATCH_TICK ms
+#define DISPATCH_TICK 10
+#define WHEEL_SIZE 128
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+// epoll id of the tick timer
+#define DISPATCH_TICK_ID GPIO_COUNT
 
 typedef void (*callbk_t)();
 
 typedef struct {
-    unsigned int flankCounter;
+    edge_ring_t ring; // edges published by the ISR thread
     unsigned int gpio;
     pthread_t pth;
     thread_t thread;
@@ -16,11 +32,55 @@ typedef struct {
     int timeout;
     int fd;
     unsigned int edge;
-    cond_wait_t *condWait;
+    uint64_t eventTime;
+    activation_t *activation; // the ISR only runs while it is set
+    atomic_bool stop; // ends the thread of the pin, see del_isr_func()
+    int stopFd; // eventfd which wakes the thread from poll() when stop is set
+
+    // ISR_DISPATCHER only
+    atomic_bool registered;
+    atomic_bool armed; // fd is in the epoll set with events, inactive pins are disarmed
+    uint32_t epollEvents;
+    uint64_t deadline; // tick of the next timeout
 } gpioISR_t;
 
 gpioISR_t gpioISR[GPIO_COUNT];
 
+static int isrBackend = ISR_BACKEND_SYSFS;
+static const char *isrChip = GPIO_CHIP;
+
+static int dispatcherFd = -1; // epoll fd, -1 if every pin gets its own thread
+static int tickFd;
+static pthread_t dispatcherPth;
+static thread_t dispatcherThread;
+// incremented before and after the dispatcher handles the events of one epoll_wait()
+static atomic_uint dispatcherBatch;
+// pins which the dispatcher has to put into the timer wheel
+static atomic_ullong pendingPins;
+static atomic_ullong registeredPins;
+static uint64_t wheel[WHEEL_SIZE]; // bit mask of pins per slot
+static uint64_t tick;
+
+// ISR_BACKEND_REGISTER
+static pthread_t pollerPth;
+static thread_t pollerThread;
+static unsigned int pollInterval = REGISTER_POLL_INTERVAL;
+static atomic_ullong polledPins;
+// incremented before and after the poller handles the events of one GPEDS read
+static atomic_uint pollerBatch;
+static atomic_bool pollerStop;
+
+// ISR_BACKEND_REPLAY, the pins are only fed by replay_edge_trace()
+static atomic_ullong replayPins;
+
+// edge trace, one ring per pin which is drained by the trace writer
+static _Atomic(edge_ring_t *) traceRings;
+static FILE *traceFile;
+static pthread_t traceWriterPth;
+static atomic_bool traceStop;
+// publishers which may still push into the trace rings, stop_edge_trace() waits for them
+static atomic_uint tracePublishers;
+
 // Init peripheral data struct
 struct bcm2837_peripheral gpio = {GPIO_BASE};
 
@@ -50,17 +110,264 @@ int map_peripherals() {
     }
 
     gpio.addr = (volatile unsigned int *) gpio.map;
+    gpio.sim = false;
+
+    return 0;
+}
+
+// Map a shared memory file with the layout of the GPIO block (see gpiosim.c)
+int map_sim_peripherals(const char *path) {
+    if ((gpio.mem_fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) {
+        printf("Fehler beim Öffnen von %s.\n", path);
+        return -1;
+    }
+
+    // a new file is zero filled which equals the reset state of the registers
+    if (ftruncate(gpio.mem_fd, BLOCK_SIZE) == -1) {
+        perror("ftruncate");
+        close(gpio.mem_fd);
+        return -1;
+    }
+
+    gpio.map = mmap(
+            NULL,
+            BLOCK_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            gpio.mem_fd,
+            0
+    );
+
+    close(gpio.mem_fd);
+
+    if (gpio.map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    gpio.addr = (volatile unsigned int *) gpio.map;
+    gpio.sim = true;
 
     return 0;
 }
 
+// Create and open the FIFO <dir>/gpio<pin> of the fake event source (see set_isr_backend())
+int sim_open_event_fifo(const char *dir, int pin) {
+    char path[255];
+    int fd;
+
+    snprintf(path, sizeof path, "%s/gpio%d", dir, pin);
+    if (mkfifo(path, 0666) == -1 && errno != EEXIST) {
+        perror("mkfifo");
+        return -1;
+    }
+
+    // non blocking so that a slow reader drops events instead of stalling the writer
+    if ((fd = open(path, O_RDWR | O_NONBLOCK)) < 0) {
+        perror("open");
+        return -1;
+    }
+
+    return fd;
+}
+
+// Write one edge at time (ns, monotonic) into an event FIFO, false if the reader is too slow
+bool sim_write_event(int fd, uint64_t time, int level) {
+    struct gpioevent_data ev = {time, level ? GPIOEVENT_EVENT_RISING_EDGE : GPIOEVENT_EVENT_FALLING_EDGE};
+
+    return write(fd, &ev, sizeof ev) == sizeof ev;
+}
+
+// Change GPLEV of pin in the simulated block and flag the edge in GPEDS if it is enabled
+void sim_drive_level(int pin, int level) {
+    volatile unsigned int *bank = gpio.addr + pin / 32;
+    unsigned int mask = 1u << (pin % 32);
+
+    if (level) {
+        __atomic_fetch_or(bank + GPLEV0, mask, __ATOMIC_RELEASE);
+        if (bank[GPREN0] & mask) __atomic_fetch_or(bank + GPEDS0, mask, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(bank + GPLEV0, ~mask, __ATOMIC_RELEASE);
+        if (bank[GPFEN0] & mask) __atomic_fetch_or(bank + GPEDS0, mask, __ATOMIC_RELEASE);
+    }
+}
+
 // Remove physical memory mapping
 void unmap_peripherals() {
     munmap(gpio.map, BLOCK_SIZE);
 }
 
+// Hand the edge at isr->eventTime to the ring, the trace and the callback
+static void publish_edge(gpioISR_t *isr, int level) {
+    edge_ring_t *trace;
+
+    edge_ring_push(&isr->ring, isr->eventTime, isr->gpio, level);
+
+    // announced before the rings are loaded again, so stop_edge_trace() either sees this
+    // publisher or this publisher sees the rings gone
+    if (atomic_load_explicit(&traceRings, memory_order_relaxed) != nullptr) {
+        atomic_fetch_add(&tracePublishers, 1);
+        trace = atomic_load(&traceRings);
+        if (trace != nullptr) edge_ring_push(&trace[isr->gpio], isr->eventTime, isr->gpio, level);
+        atomic_fetch_sub(&tracePublishers, 1);
+    }
+
+    if (gpioStats != nullptr) {
+        stats_add(&gpioStats->pins[isr->gpio].edges, 1);
+        stats_hist(gpioStats->pins[isr->gpio].latency, get_clock_time() - isr->eventTime);
+    }
+
+    // call user defined handler
+    if (isr->func != nullptr) (isr->func)(isr->gpio, level);
+}
+
+static void count_error(gpioISR_t *isr) {
+    if (gpioStats != nullptr) stats_add(&gpioStats->pins[isr->gpio].errors, 1);
+}
+
+// The fake event source and a trace deliver both edges, only the ones of isr->edge count
+static bool is_wanted_edge(gpioISR_t *isr, int level) {
+    return !((isr->edge == EDGE_RISING && level != GPIO_ON) || (isr->edge == EDGE_FALLING && level != GPIO_OFF));
+}
+
+// Consume a sysfs interrupt and hand it to the ring and the callback
+static void handle_sysfs_event(gpioISR_t *isr) {
+    char buf[64];
+    int level;
+
+    // consume interrupt
+    lseek(isr->fd, 0, SEEK_SET);
+    if (read(isr->fd, buf, sizeof buf) == -1) { /* ignore errors */ }
+
+    if (isr->edge == EDGE_RISING) level = GPIO_ON; else level = GPIO_OFF;
+    isr->eventTime = get_clock_time();
+
+    publish_edge(isr, level);
+}
+
+// Read all queued events of the character device and hand them over in one batch. Edges
+// before activeSince were queued while the ISR was not active and are dropped.
+static void handle_cdev_events(gpioISR_t *isr, uint64_t activeSince) {
+    struct gpioevent_data events[CDEV_EVENT_BATCH];
+    ssize_t len;
+    int level;
+
+    // one read returns all queued events up to the size of the buffer
+    len = read(isr->fd, events, sizeof events);
+    if (len < (ssize_t) sizeof events[0]) {
+        RTLOG("read return error\n");
+        count_error(isr);
+        return;
+    }
+
+    for (int i = 0; i < len / (ssize_t) sizeof events[0]; i++) {
+        level = events[i].id == GPIOEVENT_EVENT_RISING_EDGE ? GPIO_ON : GPIO_OFF;
+
+        if (!is_wanted_edge(isr, level)) continue;
+
+        isr->eventTime = events[i].timestamp / 1000;
+        // the first event of the batch is the one which woke the thread
+        if (i == 0) latency_record(isr->eventTime);
+
+        // drop edges which were queued while the ISR was not active
+        if (isr->eventTime < activeSince) continue;
+
+        publish_edge(isr, level);
+    }
+}
+
+// Consume the pending events of a pin which is not active anymore without handing them over
+static void drop_events(gpioISR_t *isr, bool cdev) {
+    struct gpioevent_data events[CDEV_EVENT_BATCH];
+
+    if (!cdev) lseek(isr->fd, 0, SEEK_SET);
+    if (read(isr->fd, events, sizeof events) == -1) { /* ignore errors */ }
+}
+
+// No edge for isr->timeout ms
+static void handle_timeout(gpioISR_t *isr) {
+    isr->eventTime = get_clock_time();
+    if (gpioStats != nullptr) stats_add(&gpioStats->pins[isr->gpio].timeouts, 1);
+    if (isr->func != nullptr) (isr->func)(isr->gpio, GPIO_TIMEOUT);
+}
+
+static bool is_active(gpioISR_t *isr) {
+    return !atomic_load_explicit(&isr->stop, memory_order_relaxed)
+           && (isr->activation == nullptr || is_activated(isr->activation));
+}
+
+// Sleep until the pin is activated, false if its thread has to end
+static bool wait_for_activation(gpioISR_t *isr) {
+    if (isr->activation == nullptr) return !atomic_load(&isr->stop);
+    if (!wait_activation_or_stop(isr->activation, &isr->stop)) return false;
+
+    latency_record(atomic_load(&isr->activation->signalTime));
+    return true;
+}
+
+// One edge flagged in GPEDS. Several edges of a pin between two polls are seen as one.
+static void handle_register_event(gpioISR_t *isr, uint64_t time, int level) {
+    if (isr->edge == EDGE_RISING) level = GPIO_ON; else if (isr->edge == EDGE_FALLING) level = GPIO_OFF;
+    isr->eventTime = time;
+
+    publish_edge(isr, level);
+}
+
+// Polls GPEDS of all registered pins from the mapping, no syscall per edge. Runs until the
+// last pin is removed.
+static void pthRegisterPoller() {
+    struct timespec next;
+    gpio_mask_t pins, events, levels = 0, bit;
+    gpioISR_t *isr;
+    uint64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!atomic_load(&pollerStop)) {
+        atomic_fetch_add(&pollerBatch, 1);
+
+        pins = atomic_load(&polledPins);
+        events = gpio_read_events() & pins;
+        now = get_clock_time();
+
+        if (events) {
+            gpio_clear_events(events);
+            levels = gpio_read_all();
+        }
+
+        while (pins) {
+            bit = pins & -pins;
+            pins &= ~bit;
+            isr = &gpioISR[__builtin_ctzll(bit)];
+
+            // events of inactive pins are acknowledged and dropped
+            if (!is_active(isr)) {
+                isr->eventTime = now;
+                continue;
+            }
+
+            if (events & bit) {
+                handle_register_event(isr, now, (levels & bit) ? GPIO_ON : GPIO_OFF);
+            } else if (now - isr->eventTime >= (uint64_t) isr->timeout * 1000) {
+                handle_timeout(isr);
+            }
+        }
+
+        atomic_fetch_add(&pollerBatch, 1);
+
+        RTMEM_CHECK();
+        if (pollInterval == 0) continue;
+        next.tv_nsec += pollInterval;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0);
+    }
+}
+
 // Simulates interrupts via polling
-_Noreturn static void pthISRThread(void *x) {
+static void pthISRThread(void *x) {
 #ifdef TIMER
     struct timespec startTime, endTime, diffTime;
     clockid_t threadClockId;
@@ -68,10 +375,9 @@ _Noreturn static void pthISRThread(void *x) {
 #endif
     gpioISR_t *isr = x;
     int retval;
-    struct pollfd pfd;
+    struct pollfd pfd[2];
     int fd;
     char buf[64];
-    int level;
 
     // file to poll
     sprintf(buf, "/sys/class/gpio/gpio%d/value", isr->gpio);
@@ -85,42 +391,85 @@ _Noreturn static void pthISRThread(void *x) {
     // store fd because it has to be closed after stopping this thread
     isr->fd = fd;
 
-    pfd.fd = fd;
-
-    pfd.events = POLLPRI;
+    pfd[0].fd = fd;
+    pfd[0].events = POLLPRI;
+    pfd[1].fd = isr->stopFd;
+    pfd[1].events = POLLIN;
 
     // consume any prior interrupt
     lseek(fd, 0, SEEK_SET);
     if (read(fd, buf, sizeof buf) == -1) { /* ignore errors */ }
 
-    while (1) {
-        if (isr->condWait != nullptr) {
-            pthread_mutex_lock(&isr->condWait->pthreadMutex);
-            while (!isr->condWait->cond)
-                pthread_cond_wait(&isr->condWait->pthreadCond, &isr->condWait->pthreadMutex);
-        }
+    while (wait_for_activation(isr)) {
         PRINT_START(isr->gpio)
+        RTMEM_CHECK();
 #ifdef TIMER
         clock_gettime(threadClockId, &startTime);
 #endif
-        while (isr->condWait->cond) {
+        while (is_active(isr)) {
 
             // wait for file change event ("interrupt")
-            retval = poll(&pfd, 1, isr->timeout);
+            retval = poll(pfd, 2, isr->timeout);
 
-            if (retval >= 0) {
-                // consume interrupt
-                lseek(fd, 0, SEEK_SET);
-                if (read(fd, buf, sizeof buf) == -1) { /* ignore errors */ }
+            if (retval > 0) {
+                if (pfd[0].revents) {
+                    // deactivated while poll() waited
+                    if (is_active(isr)) handle_sysfs_event(isr); else drop_events(isr, false);
+                }
+            } else if (retval == 0) {
+                handle_timeout(isr);
+            } else {
+                RTLOG("poll return error\n");
+                count_error(isr);
+            }
+
+        }
+        PRINT_END(isr->gpio)
+#ifdef TIMER
+        clock_gettime(threadClockId, &endTime);
+        diffTime = diff(startTime, endTime);
+        RTLOG("GPIO %i time: %ld:%ld\n", isr->gpio, diffTime.tv_sec, diffTime.tv_nsec);
+#endif
+    }
+}
+
+// Waits for edge events of the GPIO character device and hands them over in batches
+static void pthCdevISRThread(void *x) {
+#ifdef TIMER
+    struct timespec startTime, endTime, diffTime;
+    clockid_t threadClockId;
+    pthread_getcpuclockid(pthread_self(), &threadClockId);
+#endif
+    gpioISR_t *isr = x;
+    struct pollfd pfd[2];
+    uint64_t activeSince;
+    int retval;
+
+    pfd[0].fd = isr->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = isr->stopFd;
+    pfd[1].events = POLLIN;
+
+    while (wait_for_activation(isr)) {
+        PRINT_START(isr->gpio)
+        RTMEM_CHECK();
+#ifdef TIMER
+        clock_gettime(threadClockId, &startTime);
+#endif
+        activeSince = get_clock_time();
+        while (is_active(isr)) {
 
-                if (retval) {
-                    if (isr->edge == EDGE_RISING) level = GPIO_ON; else level = GPIO_OFF;
-                } else level = GPIO_TIMEOUT;
+            retval = poll(pfd, 2, isr->timeout);
 
-                // call user defined handler
-                (isr->func)(isr->gpio, level);
+            if (retval > 0) {
+                if (pfd[0].revents) {
+                    if (is_active(isr)) handle_cdev_events(isr, activeSince); else drop_events(isr, true);
+                }
+            } else if (retval == 0) {
+                handle_timeout(isr);
             } else {
-                printf("poll return error\n");
+                RTLOG("poll return error\n");
+                count_error(isr);
             }
 
         }
@@ -128,25 +477,277 @@ _Noreturn static void pthISRThread(void *x) {
 #ifdef TIMER
         clock_gettime(threadClockId, &endTime);
         diffTime = diff(startTime, endTime);
-        printf("GPIO %i time: %ld:%ld\n", isr->gpio, diffTime.tv_sec, diffTime.tv_nsec);
+        RTLOG("GPIO %i time: %ld:%ld\n", isr->gpio, diffTime.tv_sec, diffTime.tv_nsec);
 #endif
-        if (isr->condWait != nullptr) {
-            pthread_mutex_unlock(&isr->condWait->pthreadMutex);
+    }
+}
+
+
+static void set_armed(gpioISR_t *isr, bool armed) {
+    struct epoll_event ev = {armed ? isr->epollEvents : 0, {.u32 = isr->gpio}};
+
+    atomic_store(&isr->armed, armed);
+    epoll_ctl(dispatcherFd, EPOLL_CTL_MOD, isr->fd, &ev);
+}
+
+static void schedule_timeout(gpioISR_t *isr) {
+    isr->deadline = tick + (isr->timeout + DISPATCH_TICK - 1) / DISPATCH_TICK;
+    wheel[isr->deadline & WHEEL_MASK] |= 1ull << isr->gpio;
+}
+
+// Advance the timer wheel by one tick and fire the timeouts of active pins. Deadlines are
+// only moved forward on edges, so an entry which fires too early is put into its new slot.
+static void advance_wheel() {
+    uint64_t pins, bit;
+    gpioISR_t *isr;
+
+    tick++;
+
+    pins = atomic_exchange(&pendingPins, 0);
+    while (pins) {
+        bit = pins & -pins;
+        pins &= ~bit;
+        schedule_timeout(&gpioISR[__builtin_ctzll(bit)]);
+    }
+
+    pins = wheel[tick & WHEEL_MASK];
+    wheel[tick & WHEEL_MASK] = 0;
+    while (pins) {
+        bit = pins & -pins;
+        pins &= ~bit;
+        isr = &gpioISR[__builtin_ctzll(bit)];
+
+        // unregistered pins just drop out of the wheel
+        if (!atomic_load(&isr->registered)) continue;
+
+        if (isr->deadline > tick) {
+            wheel[isr->deadline & WHEEL_MASK] |= bit;
+            continue;
         }
+
+        if (is_active(isr)) handle_timeout(isr);
+        schedule_timeout(isr);
+    }
+
+    // fallback for pins which were activated without arm_isr()
+    pins = atomic_load(&registeredPins);
+    while (pins) {
+        bit = pins & -pins;
+        pins &= ~bit;
+        isr = &gpioISR[__builtin_ctzll(bit)];
+        if (!atomic_load(&isr->armed) && is_active(isr)) set_armed(isr, true);
     }
 }
 
-// Setup GPIO and start listening for interrupts
-int init_isr_func(unsigned int pin, unsigned int edge, void *f,
-                  cond_wait_t *condWait, cpu_set_t *cpuset, int priority) {
+// One RT thread which waits for the edges of all registered pins with epoll
+_Noreturn static void pthDispatcherThread() {
+    struct epoll_event events[CDEV_EVENT_BATCH];
+    uint64_t expirations;
+    gpioISR_t *isr;
+    int n;
+
+    while (1) {
+        n = epoll_wait(dispatcherFd, events, CDEV_EVENT_BATCH, -1);
+        atomic_fetch_add(&dispatcherBatch, 1);
+        RTMEM_CHECK();
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 == DISPATCH_TICK_ID) {
+                if (read(tickFd, &expirations, sizeof expirations) == sizeof expirations) {
+                    while (expirations--) advance_wheel();
+                }
+                continue;
+            }
+
+            isr = &gpioISR[events[i].data.u32];
+            if (!atomic_load(&isr->registered)) continue;
+
+            if (!is_active(isr)) {
+                // nobody listens to the pin, its events are consumed without a callback and it
+                // stops waking the dispatcher until arm_isr() or the next tick arms it again
+                drop_events(isr, isr->epollEvents == EPOLLIN);
+                set_armed(isr, false);
+                if (is_active(isr)) set_armed(isr, true);
+                continue;
+            }
+
+            if (isr->epollEvents == EPOLLIN) {
+                handle_cdev_events(isr, isr->activation != nullptr ? atomic_load(&isr->activation->signalTime) : 0);
+            } else {
+                handle_sysfs_event(isr);
+            }
+            isr->deadline = tick + (isr->timeout + DISPATCH_TICK - 1) / DISPATCH_TICK;
+        }
+
+        atomic_fetch_add(&dispatcherBatch, 1);
+        exec_time_record();
+    }
+}
+
+// Start the dispatcher thread with plan, or on cpuset with priority if there is none
+static int start_dispatcher(cpu_set_t *cpuset, int priority, const thread_plan_t *plan) {
+    struct itimerspec interval = {{0, DISPATCH_TICK * 1000000}, {0, DISPATCH_TICK * 1000000}};
+    struct epoll_event ev = {EPOLLIN, {.u32 = DISPATCH_TICK_ID}};
+
+    if (dispatcherFd != -1) return 1;
+
+    if ((dispatcherFd = epoll_create1(EPOLL_CLOEXEC)) < 0) return ERROR_DISPATCHER_FAIL;
+
+    if ((tickFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0
+        || timerfd_settime(tickFd, 0, &interval, NULL) < 0
+        || epoll_ctl(dispatcherFd, EPOLL_CTL_ADD, tickFd, &ev) < 0) {
+        close(dispatcherFd);
+        dispatcherFd = -1;
+        return ERROR_DISPATCHER_FAIL;
+    }
+
+    dispatcherThread = (thread_t) {pthDispatcherThread, nullptr};
+    if (plan != nullptr ? start_planned_thread(&dispatcherPth, &dispatcherThread, plan)
+                        : start_realtime_thread(&dispatcherPth, &dispatcherThread, cpuset, priority)) {
+        close(tickFd);
+        close(dispatcherFd);
+        dispatcherFd = -1;
+        return ERROR_THREAD_ALLOC_FAIL;
+    }
+
+    return 0;
+}
+
+int start_isr_dispatcher(cpu_set_t *cpuset, int priority) {
+    return start_dispatcher(cpuset, priority, nullptr);
+}
+
+int start_planned_isr_dispatcher(const thread_plan_t *plan) {
+    return start_dispatcher(nullptr, 0, plan);
+}
+
+void arm_isr(unsigned int pin) {
+    if (pin < GPIO_COUNT && dispatcherFd != -1 && atomic_load(&gpioISR[pin].registered) && !atomic_load(&gpioISR[pin].armed)) {
+        set_armed(&gpioISR[pin], true);
+    }
+}
+
+// Add the (already set up) line of pin to the dispatcher
+static int register_dispatched_pin(unsigned int pin) {
+    gpioISR_t *isr = &gpioISR[pin];
+    struct epoll_event ev;
+    char buf[64];
+
+    if (isrBackend == ISR_BACKEND_CDEV) {
+        isr->epollEvents = EPOLLIN;
+    } else {
+        sprintf(buf, "/sys/class/gpio/gpio%d/value", pin);
+        if ((isr->fd = open(buf, O_RDONLY)) < 0) return ERROR_EXPORT_FAIL;
+
+        // consume any prior interrupt
+        if (read(isr->fd, buf, sizeof buf) == -1) { /* ignore errors */ }
+        isr->epollEvents = EPOLLPRI | EPOLLERR;
+    }
+
+    ev.events = isr->epollEvents;
+    ev.data.u32 = pin;
+    atomic_store(&isr->armed, true);
+    atomic_store(&isr->registered, true);
+
+    if (epoll_ctl(dispatcherFd, EPOLL_CTL_ADD, isr->fd, &ev) < 0) {
+        atomic_store(&isr->registered, false);
+        close(isr->fd);
+        return ERROR_DISPATCHER_FAIL;
+    }
+
+    atomic_fetch_or(&registeredPins, 1ull << pin);
+    atomic_fetch_or(&pendingPins, 1ull << pin);
+
+    return 0;
+}
+
+// Remove pin from the dispatcher, returns when the dispatcher can't call its callback anymore
+static void unregister_dispatched_pin(unsigned int pin) {
+    gpioISR_t *isr = &gpioISR[pin];
+    unsigned int batch;
+
+    atomic_store(&isr->registered, false);
+    atomic_fetch_and(&registeredPins, ~(1ull << pin));
+    epoll_ctl(dispatcherFd, EPOLL_CTL_DEL, isr->fd, NULL);
+
+    // an odd count means the dispatcher is handling events which may belong to pin
+    batch = atomic_load(&dispatcherBatch);
+    if (batch & 1) {
+        while (atomic_load(&dispatcherBatch) == batch) usleep(100);
+    }
+
+    close(isr->fd);
+}
+
+void set_isr_backend(int backend, const char *chip) {
+    isrBackend = backend;
+    if (chip != nullptr) isrChip = chip;
+}
+
+void set_register_poll_interval(unsigned int interval) {
+    pollInterval = interval;
+}
+
+// Configure pin as input and enable its edge detection in GPREN/GPFEN
+static void setup_register_line(unsigned int pin, unsigned int edge) {
+    uint32_t mask = 1u << (pin % 32);
+
+    gpio_input(pin);
+    if (edge == EDGE_RISING || edge == EDGE_BOTH) gpio.addr[GPREN0 + pin / 32] |= mask;
+    if (edge == EDGE_FALLING || edge == EDGE_BOTH) gpio.addr[GPFEN0 + pin / 32] |= mask;
+
+    // consume any prior event
+    gpio_clear_events(GPIO_MASK(pin));
+}
+
+// Add pin to the poller, which is started with cpuset and priority of the first pin
+static int register_polled_pin(unsigned int pin, cpu_set_t *cpuset, int priority) {
+    gpioISR[pin].eventTime = get_clock_time();
+    atomic_fetch_or(&polledPins, GPIO_MASK(pin));
+
+    if (pollerPth == 0) {
+        atomic_store(&pollerStop, false);
+        pollerThread = (thread_t) {pthRegisterPoller, nullptr};
+        if (start_realtime_thread(&pollerPth, &pollerThread, cpuset, priority)) {
+            atomic_fetch_and(&polledPins, ~GPIO_MASK(pin));
+            pollerPth = 0;
+            return ERROR_THREAD_ALLOC_FAIL;
+        }
+    }
+
+    return 0;
+}
+
+// Remove pin from the poller, returns when the poller can't call its callback anymore
+static void unregister_polled_pin(unsigned int pin) {
+    uint32_t mask = 1u << (pin % 32);
+    unsigned int batch;
+
+    atomic_fetch_and(&polledPins, ~GPIO_MASK(pin));
+    gpio.addr[GPREN0 + pin / 32] &= ~mask;
+    gpio.addr[GPFEN0 + pin / 32] &= ~mask;
+
+    // an odd count means the poller is handling events which may belong to pin
+    batch = atomic_load(&pollerBatch);
+    if (batch & 1) {
+        while (atomic_load(&pollerBatch) == batch) usleep(10);
+    }
+
+    // stop the poller with the last pin, so it never touches an unmapped block
+    if (atomic_load(&polledPins) == 0) {
+        atomic_store(&pollerStop, true);
+        pthread_join(pollerPth, NULL);
+        pollerPth = 0;
+    }
+}
+
+// Export pin via sysfs and configure it as input with edge detection
+static int setup_sysfs_line(unsigned int pin, unsigned int edge) {
     int fd;
     int err;
     char buf[64];
     char *edge_str[] = {"rising\n", "falling\n", "both\n"};
 
-    // do nothing if thread is already running
-    if (gpioISR[pin].pth != 0) return 1;
-
     // enblae gpio
     fd = open("/sys/class/gpio/export", O_WRONLY);
     if (fd < 0) return ERROR_EXPORT_FAIL;
@@ -172,18 +773,109 @@ int init_isr_func(unsigned int pin, unsigned int edge, void *f,
     write(fd, edge_str[edge], strlen(edge_str[edge]));
     close(fd);
 
+    return 0;
+}
+
+// Request an edge event fd for pin from the GPIO character device
+static int setup_cdev_line(unsigned int pin, unsigned int edge) {
+    struct gpioevent_request req;
+    struct stat st;
+    uint32_t edge_flags[] = {GPIOEVENT_REQUEST_RISING_EDGE, GPIOEVENT_REQUEST_FALLING_EDGE,
+                             GPIOEVENT_REQUEST_BOTH_EDGES};
+    char buf[255];
+    int fd;
+
+    if (stat(isrChip, &st) == 0 && S_ISDIR(st.st_mode)) {
+        // fake event source: FIFO with struct gpioevent_data records, opened
+        // read/write so that poll() never reports a hang up without writer
+        snprintf(buf, sizeof buf, "%s/gpio%d", isrChip, pin);
+        if ((fd = open(buf, O_RDWR)) < 0) return ERROR_CHIP_OPEN_FAIL;
+        gpioISR[pin].fd = fd;
+        return 0;
+    }
+
+    if ((fd = open(isrChip, O_RDONLY)) < 0) return ERROR_CHIP_OPEN_FAIL;
+
+    memset(&req, 0, sizeof req);
+    req.lineoffset = pin;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = edge_flags[edge];
+    strncpy(req.consumer_label, "gpio", sizeof req.consumer_label);
+
+    if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        close(fd);
+        return ERROR_LINE_REQUEST_FAIL;
+    }
+
+    // the line stays requested as long as the event fd is open
+    close(fd);
+    gpioISR[pin].fd = req.fd;
+
+    return 0;
+}
+
+// Setup GPIO and start listening for interrupts
+int init_isr_func(unsigned int pin, unsigned int edge, void *f,
+                  activation_t *activation, cpu_set_t *cpuset, int priority) {
+    int err;
+
+    if (pin >= GPIO_COUNT) return -1;
+
+    // do nothing if thread is already running
+    if (gpioISR[pin].pth != 0 || atomic_load(&gpioISR[pin].registered)
+        || ((atomic_load(&polledPins) | atomic_load(&replayPins)) & GPIO_MASK(pin)))
+        return 1;
+
+    // left over from the last del_isr_func() of pin, which may have used another backend
+    atomic_store(&gpioISR[pin].stop, false);
+    atomic_store(&gpioISR[pin].registered, false);
+    atomic_store(&gpioISR[pin].armed, false);
+
+    if (isrBackend == ISR_BACKEND_REPLAY) {
+        err = 0;
+    } else if (isrBackend == ISR_BACKEND_REGISTER) {
+        setup_register_line(pin, edge);
+        err = 0;
+    } else if (isrBackend == ISR_BACKEND_CDEV) {
+        err = setup_cdev_line(pin, edge);
+    } else {
+        err = setup_sysfs_line(pin, edge);
+    }
+    if (err) return err;
+
     // start listening for interrupts on pin
-    thread_t thread = {pthISRThread, &gpioISR[pin]};
+    thread_t thread = {isrBackend == ISR_BACKEND_CDEV ? pthCdevISRThread : pthISRThread, &gpioISR[pin]};
     gpioISR[pin].gpio = pin;
     gpioISR[pin].thread = thread;
     gpioISR[pin].func = f;
     gpioISR[pin].timeout = 1000;
     gpioISR[pin].edge = edge;
-    gpioISR[pin].condWait = condWait;
+    gpioISR[pin].activation = activation;
+    edge_ring_init(&gpioISR[pin].ring);
+
+    if (isrBackend == ISR_BACKEND_REGISTER) {
+        return register_polled_pin(pin, cpuset, priority);
+    }
+
+    if (isrBackend == ISR_BACKEND_REPLAY) {
+        atomic_fetch_or(&replayPins, GPIO_MASK(pin));
+        return 0;
+    }
+
+    if (dispatcherFd != -1) {
+        return register_dispatched_pin(pin);
+    }
+
+    if ((gpioISR[pin].stopFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        if (isrBackend == ISR_BACKEND_CDEV) close(gpioISR[pin].fd);
+        return ERROR_THREAD_ALLOC_FAIL;
+    }
 
     start_realtime_thread(&gpioISR[pin].pth, &gpioISR[pin].thread, cpuset, priority);
 
     if (gpioISR[pin].pth == 0) {
+        if (isrBackend == ISR_BACKEND_CDEV) close(gpioISR[pin].fd);
+        close(gpioISR[pin].stopFd);
         return ERROR_THREAD_ALLOC_FAIL;
     }
 
@@ -192,10 +884,38 @@ int init_isr_func(unsigned int pin, unsigned int edge, void *f,
 
 // Stop listening for interrupts and clean resources
 int del_isr_func(unsigned int pin) {
+    if (pin >= GPIO_COUNT) return -1;
+
+    if (atomic_load(&replayPins) & GPIO_MASK(pin)) {
+        atomic_fetch_and(&replayPins, ~GPIO_MASK(pin));
+        gpioISR[pin].timeout = 0;
+        gpioISR[pin].edge = 0;
+        return 0;
+    }
+
+    if (atomic_load(&polledPins) & GPIO_MASK(pin)) {
+        unregister_polled_pin(pin);
+        gpioISR[pin].timeout = 0;
+        gpioISR[pin].edge = 0;
+        return 0;
+    }
+
+    if (atomic_load(&gpioISR[pin].registered)) {
+        unregister_dispatched_pin(pin);
+        gpioISR[pin].timeout = 0;
+        gpioISR[pin].edge = 0;
+        return 0;
+    }
+
     if (gpioISR[pin].pth == 0) return ERROR_ISR_NOT_INITED;
 
-    pthread_cancel(gpioISR[pin].pth);
+    // the thread ends at its next check instead of being cancelled where it may hold the log
+    // ring or a seqlock: a kick wakes it from the activation, the eventfd from poll()
+    atomic_store(&gpioISR[pin].stop, true);
+    if (gpioISR[pin].activation != nullptr) kick_activation(gpioISR[pin].activation);
+    if (eventfd_write(gpioISR[pin].stopFd, 1) == -1) { /* the thread still ends after its timeout */ }
     pthread_join(gpioISR[pin].pth, NULL);
+    close(gpioISR[pin].stopFd);
 
     gpioISR[pin].gpio = 0;
     gpioISR[pin].thread = (thread_t) {0, nullptr};
@@ -207,43 +927,255 @@ int del_isr_func(unsigned int pin) {
     return 0;
 }
 
-// Return monotonic clock time in us
-uint64_t get_clock_time() {
-    struct timespec ts;
+uint64_t get_isr_event_time(unsigned int pin) {
+    return pin < GPIO_COUNT ? gpioISR[pin].eventTime : 0;
+}
 
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
-        return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
-    else
-        return 0;
+edge_ring_t *get_isr_ring(unsigned int pin) {
+    return pin < GPIO_COUNT ? &gpioISR[pin].ring : nullptr;
 }
 
-// Helper ISR for read_input_freq()
+// Helper ISR for read_input_freq(). The edges are counted from the ring of the
+// pin, so nothing is left to do here.
 void freq_counter(int pin, int level) {
-    if (level != GPIO_TIMEOUT) gpioISR[pin].flankCounter++;
+    (void) pin;
+    (void) level;
 }
 
-double read_input_freq(int pin, useconds_t sampleinterval, cond_wait_t *cond) {
+// Drain the ring of pin and count the edges which happened between start and end
+static unsigned int count_gate_edges(int pin, uint64_t start, uint64_t end, uint64_t *first, uint64_t *last) {
+    edge_event_t event;
+    unsigned int count = 0;
+
+    while (edge_ring_pop(&gpioISR[pin].ring, &event)) {
+        // ignore events which were queued before the gate opened
+        if (event.time < start || event.time > end) continue;
+
+        if (count == 0) *first = event.time;
+        *last = event.time;
+        count++;
+    }
+
+    return count;
+}
+
+static void count_measurement(int pin, double freq) {
+    if (gpioStats == nullptr) return;
+    stats_add(&gpioStats->pins[pin].measurements, 1);
+    atomic_store_explicit(&gpioStats->pins[pin].lastFreq, (unsigned long long) (freq * 1000), memory_order_relaxed);
+}
+
+double read_input_freq(int pin, useconds_t sampleinterval, activation_t *activation) {
     uint64_t prev_time_value, time_value;
+    uint64_t first, last;
     double time_diff;
     double freq;
-    int err;
 
-    gpioISR[pin].flankCounter = 0;
+    if (pin < 0 || pin >= GPIO_COUNT) return -1;
+
+    edge_ring_flush(&gpioISR[pin].ring);
     prev_time_value = get_clock_time();
 
-    cond->cond = true;
-    pthread_cond_signal(&cond->pthreadCond);
-    //err = init_isr_func(pin, EDGE_RISING, counter, nullptr, cpuset, priority);
+    activate(activation);
+    arm_isr(pin);
     // count interrupts for sampleinterval us
     usleep(sampleinterval);
-    //del_isr_func(pin);
 
-    cond->cond = false;
+    deactivate(activation);
     time_value = get_clock_time(); // in us
     time_diff = (time_value - prev_time_value); // in us
 
-    freq = ((gpioISR[pin].flankCounter / time_diff) * 1000000);
+    freq = ((count_gate_edges(pin, prev_time_value, time_value, &first, &last) / time_diff) * 1000000);
+    count_measurement(pin, freq);
 
+    return freq;
+}
+
+double read_input_freq_reciprocal(int pin, useconds_t sampleinterval, activation_t *activation) {
+    uint64_t start, first, last;
+    uint64_t period_time;
+    unsigned int edges;
+    double freq;
+
+    if (pin < 0 || pin >= GPIO_COUNT) return -1;
+
+    edge_ring_flush(&gpioISR[pin].ring);
+    start = get_clock_time();
+
+    activate(activation);
+    arm_isr(pin);
+    usleep(sampleinterval);
+    deactivate(activation);
+
+    edges = count_gate_edges(pin, start, get_clock_time(), &first, &last);
+
+    // n edges enclose n - 1 periods, independent of where the gate starts and ends
+    period_time = edges < 2 ? 0 : last - first; // in us
+    freq = period_time == 0 ? 0 : ((double) (edges - 1) / period_time) * 1000000;
+    count_measurement(pin, freq);
 
     return freq;
-}
\ No newline at end of file
+}
+
+void set_isr_timeout(unsigned int pin, int timeout) {
+    if (pin < GPIO_COUNT) gpioISR[pin].timeout = timeout;
+}
+
+static int compare_trace_records(const void *a, const void *b) {
+    uint64_t x = ((const struct edge_trace_record *) a)->time, y = ((const struct edge_trace_record *) b)->time;
+    return (x > y) - (x < y);
+}
+
+// Drains the trace rings of all pins and merges them by time. An edge may reach its ring up to
+// EDGE_TRACE_HOLD us after its time stamp, so only the edges older than that are appended, the
+// newer ones wait for the next round. Returns the number of edges which still came too late.
+static void *trace_writer(void *arg) {
+    static struct edge_trace_record pending[EDGE_TRACE_PENDING];
+    edge_ring_t *rings = arg;
+    uint64_t watermark, last = 0;
+    unsigned long late = 0;
+    edge_event_t event;
+    int count = 0, ready;
+    bool stop, popped;
+
+    do {
+        stop = atomic_load(&traceStop);
+        // taken before the rings are drained, the edges older than it are all in the rings by now
+        watermark = get_clock_time() - EDGE_TRACE_HOLD;
+
+        popped = false;
+        for (int pin = 0; pin < GPIO_COUNT && count < EDGE_TRACE_PENDING; pin++) {
+            while (count < EDGE_TRACE_PENDING && edge_ring_pop(&rings[pin], &event)) {
+                pending[count++] = (struct edge_trace_record) {event.time, event.pin, event.level};
+                popped = true;
+            }
+        }
+        qsort(pending, count, sizeof pending[0], compare_trace_records);
+
+        // everything at the end and when the buffer is full, it would block the rings otherwise
+        ready = 0;
+        if (stop || count == EDGE_TRACE_PENDING) ready = count;
+        else while (ready < count && pending[ready].time < watermark) ready++;
+
+        if (ready > 0) {
+            for (int i = 0; i < ready && pending[i].time < last; i++) late++;
+            last = pending[ready - 1].time;
+            fwrite(pending, sizeof pending[0], ready, traceFile);
+            fflush(traceFile);
+            count -= ready;
+            memmove(pending, pending + ready, count * sizeof pending[0]);
+        }
+
+        if (!popped || count < EDGE_TRACE_PENDING / 2) usleep(EDGE_TRACE_PERIOD);
+    } while (!stop || count > 0);
+
+    return (void *) late;
+}
+
+int start_edge_trace(const char *file, cpu_set_t *cpuset) {
+    struct edge_trace_header header = {EDGE_TRACE_MAGIC, EDGE_TRACE_VERSION, sizeof(struct edge_trace_record),
+                                       get_clock_time()};
+    pthread_attr_t attr;
+    edge_ring_t *rings;
+    int err;
+
+    if (atomic_load(&traceRings) != nullptr) return -1;
+
+    if ((traceFile = fopen(file, "wb")) == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    fwrite(&header, sizeof header, 1, traceFile);
+
+    if ((rings = aligned_alloc(CACHE_LINE_SIZE, GPIO_COUNT * sizeof(edge_ring_t))) == NULL) {
+        fclose(traceFile);
+        return -1;
+    }
+    for (int pin = 0; pin < GPIO_COUNT; pin++) edge_ring_init(&rings[pin]);
+
+    atomic_store(&traceStop, false);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpuset);
+    err = pthread_create(&traceWriterPth, &attr, trace_writer, rings);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        free(rings);
+        fclose(traceFile);
+        return -1;
+    }
+
+    atomic_store_explicit(&traceRings, rings, memory_order_release);
+
+    return 0;
+}
+
+void stop_edge_trace() {
+    edge_ring_t *rings = atomic_exchange(&traceRings, nullptr);
+    unsigned int dropped = 0;
+    void *late;
+
+    if (rings == nullptr) return;
+
+    // wait for the publishers which loaded the rings before the exchange
+    while (atomic_load(&tracePublishers) != 0) usleep(10);
+    atomic_store(&traceStop, true);
+    pthread_join(traceWriterPth, &late);
+
+    for (int pin = 0; pin < GPIO_COUNT; pin++) dropped += spsc_ring_dropped(&rings[pin].ring);
+    if (dropped > 0) printf("edge trace: %u edges dropped\n", dropped);
+    if (late != NULL) printf("edge trace: %lu edges out of order\n", (unsigned long) late);
+
+    fclose(traceFile);
+    free(rings);
+}
+
+long replay_edge_trace(const char *file, double speed) {
+    struct edge_trace_header header;
+    struct edge_trace_record records[EDGE_TRACE_BATCH];
+    struct timespec ts;
+    uint64_t start, due;
+    long replayed = 0;
+    size_t count;
+    gpioISR_t *isr;
+    FILE *fp;
+
+    if ((fp = fopen(file, "rb")) == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    if (fread(&header, sizeof header, 1, fp) != 1 || header.magic != EDGE_TRACE_MAGIC
+        || header.version != EDGE_TRACE_VERSION || header.recordSize != sizeof records[0]) {
+        printf("%s is no edge trace\n", file);
+        fclose(fp);
+        return -1;
+    }
+
+    // the time from the start of the recording to the first edge is replayed as well
+    start = get_clock_time();
+    while ((count = fread(records, sizeof records[0], EDGE_TRACE_BATCH, fp)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            // keep the distances between the edges, divided by speed
+            if (speed > 0 && records[i].time > header.start) {
+                due = start + (uint64_t) ((double) (records[i].time - header.start) / speed);
+                ts.tv_sec = (time_t) (due / 1000000);
+                ts.tv_nsec = (long) (due % 1000000) * 1000;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+            }
+
+            if (records[i].pin >= GPIO_COUNT || !(atomic_load(&replayPins) & GPIO_MASK(records[i].pin))) continue;
+
+            isr = &gpioISR[records[i].pin];
+            if (!is_active(isr) || !is_wanted_edge(isr, records[i].level)) continue;
+
+            isr->eventTime = get_clock_time();
+            publish_edge(isr, records[i].level);
+            replayed++;
+        }
+    }
+
+    fclose(fp);
+
+    return replayed;
+}
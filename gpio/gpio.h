@@ -19,6 +19,7 @@
 #include <stdbool.h>
 
 #include "realtime.h"
+#include "edge_ring.h"
 
 // start of physical address space for peripherals
 #define BCM2837_PERI_BASE   0x3f000000
@@ -27,10 +28,45 @@
 
 #define BLOCK_SIZE          (4*1024)
 
+// GPIO 0 to 53 of the BCM2837, every table indexed by pin has this size
+#define GPIO_COUNT          54
+
+// default shared memory file of the simulated GPIO block
+#define GPIO_SIM_FILE       "/dev/shm/gpio-sim"
+
+// register offsets (in 32 bit words) inside the GPIO block, see [2] p. 90
+#define GPFSEL0             0
+#define GPSET0              7
+#define GPSET1              8
+#define GPCLR0              10
+#define GPCLR1              11
+#define GPLEV0              13
+#define GPLEV1              14
+#define GPEDS0              16
+#define GPEDS1              17
+#define GPREN0              19
+#define GPREN1              20
+#define GPFEN0              22
+#define GPFEN1              23
+#define GPPUD               37
+#define GPPUDCLK0           38
+
 #define EDGE_RISING         0
 #define EDGE_FALLING        1
 #define EDGE_BOTH           2
 
+#define ISR_BACKEND_SYSFS   0
+#define ISR_BACKEND_CDEV    1
+#define ISR_BACKEND_REGISTER 2
+// no edge source, the pins are fed by replay_edge_trace()
+#define ISR_BACKEND_REPLAY  3
+
+// default sleep between two GPEDS polls of ISR_BACKEND_REGISTER in ns
+#define REGISTER_POLL_INTERVAL 20000
+
+// default GPIO character device for ISR_BACKEND_CDEV
+#define GPIO_CHIP           "/dev/gpiochip0"
+
 #define GPIO_OFF            0
 #define GPIO_ON             1
 #define GPIO_TIMEOUT        2
@@ -40,9 +76,38 @@
 #define ERROR_EDGE_FAIL             12
 #define ERROR_THREAD_ALLOC_FAIL     13
 #define ERROR_ISR_NOT_INITED        14
+#define ERROR_CHIP_OPEN_FAIL        15
+#define ERROR_LINE_REQUEST_FAIL     16
+#define ERROR_DISPATCHER_FAIL       17
+
+#define EDGE_TRACE_MAGIC        0x54474445 // "EDGT"
+#define EDGE_TRACE_VERSION      1
+// records the trace writer handles at once and its sleep time in us when it is idle
+#define EDGE_TRACE_BATCH        4096
+#define EDGE_TRACE_PERIOD       10000
+// time in us the writer holds an edge back for the edges of other pins which are older, and the
+// edges it can hold, the rest is appended early when they are full
+#define EDGE_TRACE_HOLD         100000
+#define EDGE_TRACE_PENDING      (4 * EDGE_TRACE_BATCH)
 
 #define DEFAULT_SAMPLE_TIME     50000
+// the reciprocal measurement only needs a few periods inside the gate
+#define RECIPROCAL_SAMPLE_TIME  10000
+
+
+// Header of an edge trace file, the records follow directly after it
+struct edge_trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint64_t start; // monotonic time in us when the recording started
+};
 
+struct edge_trace_record {
+    uint64_t time; // monotonic time of the edge in us
+    uint8_t pin;
+    uint8_t level;
+} __attribute__((packed));
 
 // Periphery access struct
 struct bcm2837_peripheral {
@@ -50,41 +115,164 @@ struct bcm2837_peripheral {
     int mem_fd; // file descriptor to referer memory file /dev/mem
     void *map; // pointer to actual map for later unmap
     volatile unsigned int *addr; // start address of mapped memory
+    bool sim; // true if addr points to the simulated register file
 };
 
 extern struct bcm2837_peripheral gpio;
 
-// Macros for GPIO access
+// Set of pins, bit g is GPIO g. Build masks once with GPIO_MASK() and keep them, so every
+// access below is a single store or load of the register.
+typedef uint64_t gpio_mask_t;
+
+#define GPIO_MASK(g)    ((gpio_mask_t) 1 << (g))
+#define GPIO_BANK0      0xffffffffull // pins 0 - 31, the rest is in bank 1
+
+// Select the function of pin g (0 input, 1 output) with one write to its GPFSEL register
+static inline void gpio_function(unsigned int g, unsigned int function) {
+    volatile unsigned int *fsel = gpio.addr + GPFSEL0 + g / 10;
+    *fsel = (*fsel & ~(7u << ((g % 10) * 3))) | (function << ((g % 10) * 3));
+}
+
+static inline void gpio_input(unsigned int g) { gpio_function(g, 0); }
+
+static inline void gpio_output(unsigned int g) { gpio_function(g, 1); }
+
+// Drive all pins of mask high at once, pins not in mask keep their level.
+// GPSET is write only, so this is a plain store per bank and never a read-modify-write.
+static inline void gpio_set(gpio_mask_t mask) {
+    if (mask & GPIO_BANK0) gpio.addr[GPSET0] = (uint32_t) mask;
+    if (mask >> 32) gpio.addr[GPSET1] = (uint32_t) (mask >> 32);
+}
+
+// Drive all pins of mask low at once
+static inline void gpio_clr(gpio_mask_t mask) {
+    if (mask & GPIO_BANK0) gpio.addr[GPCLR0] = (uint32_t) mask;
+    if (mask >> 32) gpio.addr[GPCLR1] = (uint32_t) (mask >> 32);
+}
+
+// Levels of all pins of bank (0 or 1) from one load of GPLEV
+static inline uint32_t gpio_read_bank(unsigned int bank) {
+    return gpio.addr[GPLEV0 + bank];
+}
+
+// Levels of all pins, one load per bank
+static inline gpio_mask_t gpio_read_all() {
+    return gpio_read_bank(0) | (gpio_mask_t) gpio_read_bank(1) << 32;
+}
+
+// Level (0 or 1) of pin g
+static inline int gpio_read(unsigned int g) {
+    return (int) (gpio_read_bank(g / 32) >> (g % 32)) & 1;
+}
+
+// Pins which saw an enabled edge (GPREN/GPFEN) since their last gpio_clear_events()
+static inline gpio_mask_t gpio_read_events() {
+    return gpio.addr[GPEDS0] | (gpio_mask_t) gpio.addr[GPEDS1] << 32;
+}
+
+// Acknowledge the events of mask. GPEDS is write 1 to clear on the hardware, the simulated
+// block is plain memory shared with gpiosim and has to be cleared atomically.
+static inline void gpio_clear_events(gpio_mask_t mask) {
+    if (gpio.sim) {
+        if (mask & GPIO_BANK0) __atomic_fetch_and(gpio.addr + GPEDS0, ~(uint32_t) mask, __ATOMIC_ACQ_REL);
+        if (mask >> 32) __atomic_fetch_and(gpio.addr + GPEDS1, ~(uint32_t) (mask >> 32), __ATOMIC_ACQ_REL);
+    } else {
+        if (mask & GPIO_BANK0) gpio.addr[GPEDS0] = (uint32_t) mask;
+        if (mask >> 32) gpio.addr[GPEDS1] = (uint32_t) (mask >> 32);
+    }
+}
+
+// Macros for GPIO access, kept for old code
 #define INP_GPIO(g)   *(gpio.addr + ((g)/10)) &= ~(7<<(((g)%10)*3))
 #define OUT_GPIO(g)   *(gpio.addr + ((g)/10)) |=  (1<<(((g)%10)*3))
 #define SET_GPIO_ALT(g, a) *(gpio.addr + (((g)/10))) |= (((a)<=3?(a) + 4:(a)==4?3:2)<<(((g)%10)*3))
 
-#define GPIO_SET  *(gpio.addr + 7)  // set high bits and ignore low ones
-#define GPIO_CLR  *(gpio.addr + 10) // clears high bits and ignore low ones
+// GPSET0/GPCLR0 are write only, assign the bits (GPIO_SET = 1 << g), don't use |=
+#define GPIO_SET  *(gpio.addr + GPSET0)  // set high bits and ignore low ones
+#define GPIO_CLR  *(gpio.addr + GPCLR0) // clears high bits and ignore low ones
 
-#define GPIO_READ(g)  *(gpio.addr + 13) &= (1<<(g))
-#define GPIO_PULL  *(gpio.addr + 37)  // pull up and pull down activation
-#define GPIO_PULLCLK(g) *(gpio.addr + 38) &= (1<<(g)) // clock pull up or pull down
+#define GPIO_READ(g)  gpio_read(g)
+#define GPIO_PULL  *(gpio.addr + GPPUD)  // pull up and pull down activation
+#define GPIO_PULLCLK(g) *(gpio.addr + GPPUDCLK0) &= (1<<(g)) // clock pull up or pull down
 
 // Map peripherals via mmap
 extern int map_peripherals();
 
+// Map the simulated GPIO block in the shared memory file at path instead of /dev/mem
+extern int map_sim_peripherals(const char *path);
+
+// Helpers which play the hardware behind the simulated block for gpiosim and gpio_bench:
+// sim_open_event_fifo() creates and opens the non blocking FIFO <dir>/gpio<pin> of the fake
+// event source and returns its fd or -1, sim_write_event() writes one edge at time (ns) into
+// it, false if the reader is too slow, and sim_drive_level() sets the level of pin and flags
+// the edge in GPEDS like the hardware does for edges enabled in GPREN/GPFEN.
+extern int sim_open_event_fifo(const char *dir, int pin);
+extern bool sim_write_event(int fd, uint64_t time, int level);
+extern void sim_drive_level(int pin, int level);
+
 // Unmap peripherals memory
 extern void unmap_peripherals();
 
-// Listen for new interrupts on pin
+// Select how init_isr_func() receives edges. chip is the GPIO character device for
+// ISR_BACKEND_CDEV or a directory with gpio<pin> FIFOs as fake event source (see gpiosim.c),
+// ISR_BACKEND_REGISTER ignores it.
+extern void set_isr_backend(int backend, const char *chip);
+
+// Sleep interval of the ISR_BACKEND_REGISTER poller in ns, 0 spins on a dedicated core
+extern void set_register_poll_interval(unsigned int interval);
+
+// Handle the edges of all pins registered afterwards by one RT thread on cpuset with priority,
+// which waits for them with epoll, instead of one thread per pin
+extern int start_isr_dispatcher(cpu_set_t *cpuset, int priority);
+
+// Same as start_isr_dispatcher() with the core, policy and budget of plan (see start_planned_thread())
+extern int start_planned_isr_dispatcher(const thread_plan_t *plan);
+
+// With the dispatcher: listen for edges of pin again right after its activation was set.
+// Pins whose activation is not set are ignored until then or until the next timer tick.
+extern void arm_isr(unsigned int pin);
+
+// Listen for new interrupts on pin while activation is set (always if it is nullptr). Every edge
+// is published into the edge ring of the pin before f (may be nullptr) is called. cpuset and
+// priority are ignored with the dispatcher. Returns -1 if pin is out of range.
 extern int init_isr_func(unsigned int pin, unsigned int edge, void *f,
-                         cond_wait_t *condWait, cpu_set_t *cpuset, int priority);
+                         activation_t *activation, cpu_set_t *cpuset, int priority);
 
-// Stop listening for interrupts
+// Stop listening for interrupts, -1 if pin is out of range
 extern int del_isr_func(unsigned int pin);
 
-// Measure input frequency on pin in Hz for sampleintervall us
-extern double read_input_freq(int pin, useconds_t sampleinterval, cond_wait_t* cond);
+// Record every edge which is handed to the callbacks into file. The ISRs only push the edges
+// into a ring per pin, a writer thread on cpuset merges them by time and appends an edge once
+// EDGE_TRACE_HOLD us have passed, a later edge with an older time is reported at the end.
+extern int start_edge_trace(const char *file, cpu_set_t *cpuset);
+
+// Write the remaining edges and close the trace
+extern void stop_edge_trace();
+
+// Feed the edges of a trace to the callbacks and rings of the pins registered with
+// ISR_BACKEND_REPLAY, with the recorded distances divided by speed (0 = as fast as possible).
+// Edges of inactive pins and edges the pin didn't ask for are skipped like on a real line.
+// Returns the number of edges fed.
+extern long replay_edge_trace(const char *file, double speed);
 
+// Call the ISR of pin with GPIO_TIMEOUT after timeout ms without edge (default 1000)
+extern void set_isr_timeout(unsigned int pin, int timeout);
+
+// Measure input frequency on pin in Hz for sampleintervall us, activation is set during the gate.
+// Both measurements return -1 if pin is out of range.
+extern double read_input_freq(int pin, useconds_t sampleinterval, activation_t *activation);
+
+// Measure input frequency on pin in Hz from the time between the first and last edge
+// inside a gate of sampleinterval us. Returns 0 if less than two edges were seen.
+extern double read_input_freq_reciprocal(int pin, useconds_t sampleinterval, activation_t *activation);
+
+// ISR for read_input_freq() and read_input_freq_reciprocal(), both count the edges from the ring
 extern void freq_counter(int pin, int level);
 
-// Get current monotonic clock time in us
-extern uint64_t get_clock_time();
+// Edge ring of pin for a single consumer, see edge_ring.h. nullptr if pin is out of range.
+extern edge_ring_t *get_isr_ring(unsigned int pin);
+
+// Timestamp in us of the event currently handled by the ISR of pin (kernel timestamp for ISR_BACKEND_CDEV)
+extern uint64_t get_isr_event_time(unsigned int pin);
 
 #endif //GPIO_GPIO_H
@@ -0,0 +1,214 @@
+// Companion process for the simulated GPIO block (see map_sim_peripherals()).
+//
+// It plays the part of the BCM2837 hardware behind the shared memory file:
+// writes to GPSET/GPCLR are latched into GPLEV for output pins, input pins can
+// be driven from the command line or by square wave generators, and edges on
+// inputs set GPEDS according to GPREN/GPFEN. With -e the edges are also written
+// as struct gpioevent_data records into <dir>/gpio<pin> FIFOs, which serve as
+// fake event source for ISR_BACKEND_CDEV (set_isr_backend(ISR_BACKEND_CDEV, dir)).
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+
+#include "gpio.h"
+
+#define MAX_WAVES 8
+// poll interval of the register latch in ns
+#define LATCH_INTERVAL 20000
+
+typedef struct {
+    int pin;
+    uint64_t halfPeriod; // in ns
+    uint64_t next; // next toggle in ns
+    int pump; // only toggle while this output is low (-1 = always)
+    uint64_t lag; // keep toggling this long after the pump stopped in ns, water still flowing
+    uint64_t pumpOn; // last time the pump was seen running in ns
+} wave_t;
+
+static volatile sig_atomic_t running = 1;
+
+// FIFOs of the fake event source, -1 if not used
+static int eventFd[GPIO_COUNT];
+
+static void on_signal(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static volatile unsigned int *reg(int offset, int pin) {
+    return gpio.addr + offset + pin / 32;
+}
+
+static int get_level(int pin) {
+    return (*reg(GPLEV0, pin) >> (pin % 32)) & 1;
+}
+
+static bool is_output(int pin) {
+    return ((*(gpio.addr + GPFSEL0 + pin / 10) >> ((pin % 10) * 3)) & 7) == 1;
+}
+
+// Change the level of pin, write the edge into its event FIFO and flag it in GPEDS if it is enabled
+static void drive_level(int pin, int level) {
+    if (get_level(pin) == level) return;
+
+    if (eventFd[pin] >= 0 && !sim_write_event(eventFd[pin], now_ns(), level)) { /* reader too slow, drop event */ }
+    sim_drive_level(pin, level);
+}
+
+// Move pending GPSET/GPCLR writes of output pins into GPLEV
+static void latch_outputs(uint64_t start) {
+    for (int bank = 0; bank < 2; bank++) {
+        unsigned int set = __atomic_exchange_n(gpio.addr + GPSET0 + bank, 0, __ATOMIC_ACQ_REL);
+        unsigned int clr = __atomic_exchange_n(gpio.addr + GPCLR0 + bank, 0, __ATOMIC_ACQ_REL);
+
+        for (int bit = 0; bit < 32; bit++) {
+            int pin = bank * 32 + bit;
+            int level;
+
+            if (!((set | clr) & (1u << bit)) || pin >= GPIO_COUNT || !is_output(pin)) continue;
+
+            level = (set >> bit) & 1;
+            if (get_level(pin) != level) {
+                drive_level(pin, level);
+                printf("%llu us GPIO %d -> %d\n", (unsigned long long) (now_ns() - start) / 1000, pin, level);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+static int run(wave_t *waves, int waveCount) {
+    struct timespec ts;
+    uint64_t start = now_ns();
+    uint64_t wake;
+
+    for (int i = 0; i < waveCount; i++) waves[i].next = start + waves[i].halfPeriod;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (running) {
+        uint64_t now = now_ns();
+
+        latch_outputs(start);
+
+        wake = now + LATCH_INTERVAL;
+        for (int i = 0; i < waveCount; i++) {
+            wave_t *w = &waves[i];
+
+            if (w->pump >= 0 && !get_level(w->pump)) w->pumpOn = now;
+
+            while (w->next <= now) {
+                if (w->pump < 0 || now - w->pumpOn < w->lag || !get_level(w->pump))
+                    drive_level(w->pin, !get_level(w->pin));
+                w->next += w->halfPeriod;
+            }
+            if (w->next < wake) wake = w->next;
+        }
+
+        ts.tv_sec = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running);
+    }
+
+    return 0;
+}
+
+static void usage() {
+    printf("usage: gpiosim [-f file] [-e dir] set|clr|get <pin>\n"
+           "       gpiosim [-f file] [-e dir] run [-w pin:hz]... [-p pump:pin:hz[:ms]]...\n"
+           "\n"
+           "  -e dir          write edges of driven pins into the FIFOs dir/gpio<pin>\n"
+           "  -w pin:hz       square wave with hz on input pin\n"
+           "  -p pump:pin:hz[:ms]\n"
+           "                  square wave on pin while output pump is low (flow sensor) and\n"
+           "                  ms longer after it stopped (overshoot)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *file = GPIO_SIM_FILE;
+    const char *eventDir = nullptr;
+    wave_t waves[MAX_WAVES];
+    int waveCount = 0;
+    int opt;
+
+    for (int i = 0; i < GPIO_COUNT; i++) eventFd[i] = -1;
+
+    while ((opt = getopt(argc, argv, "f:e:w:p:h")) != -1) {
+        wave_t *w = &waves[waveCount];
+        double hz, lag;
+
+        switch (opt) {
+            case 'f':
+                file = optarg;
+                break;
+            case 'e':
+                eventDir = optarg;
+                break;
+            case 'w':
+            case 'p':
+                if (waveCount == MAX_WAVES) {
+                    printf("Too many wave generators\n");
+                    return 1;
+                }
+                w->pump = -1;
+                lag = 0;
+                if ((opt == 'w' && sscanf(optarg, "%d:%lf", &w->pin, &hz) != 2)
+                    || (opt == 'p' && sscanf(optarg, "%d:%d:%lf:%lf", &w->pump, &w->pin, &hz, &lag) < 3)
+                    || hz <= 0 || w->pin < 0 || w->pin >= GPIO_COUNT) {
+                    usage();
+                    return 1;
+                }
+                w->halfPeriod = (uint64_t) (500000000.0 / hz);
+                w->lag = (uint64_t) (lag * 1000000);
+                w->pumpOn = 0;
+                waveCount++;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+
+    if (map_sim_peripherals(file) == -1) return 1;
+
+    if (strcmp(argv[optind], "run") == 0) {
+        for (int i = 0; i < waveCount; i++) {
+            if (eventDir != nullptr && (eventFd[waves[i].pin] = sim_open_event_fifo(eventDir, waves[i].pin)) == -1) return 1;
+        }
+        run(waves, waveCount);
+    } else if (optind + 1 < argc) {
+        int pin = atoi(argv[optind + 1]);
+
+        if (pin < 0 || pin >= GPIO_COUNT) {
+            printf("Invalid GPIO %d\n", pin);
+            return 1;
+        }
+
+        if (eventDir != nullptr && (eventFd[pin] = sim_open_event_fifo(eventDir, pin)) == -1) return 1;
+
+        if (strcmp(argv[optind], "set") == 0) drive_level(pin, 1);
+        else if (strcmp(argv[optind], "clr") == 0) drive_level(pin, 0);
+        else if (strcmp(argv[optind], "get") == 0) printf("%d\n", get_level(pin));
+        else usage();
+    } else {
+        usage();
+    }
+
+    unmap_peripherals();
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Reader of the live statistics segment of the controller (see stats.h).
+//
+// Maps the segment read-only, so it can watch a running controller without
+// disturbing its RT threads. The records of the tasks and zones are copied
+// with the seqlock retry, the counters of the pins are read one by one.
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+static void usage() {
+    printf("usage: gpiostat [-f file] [-i seconds]\n"
+           "\n"
+           "  -f file     statistics segment (default " STATS_FILE ")\n"
+           "  -i seconds  print again every interval with the rates since the last print\n");
+}
+
+// Upper bound in us of the bucket which holds the given fraction of the samples
+static unsigned long long hist_percentile(const unsigned long long *hist, double fraction) {
+    unsigned long long total = 0, sum = 0;
+
+    for (int i = 0; i < STATS_HIST_SIZE; i++) total += hist[i];
+    if (total == 0) return 0;
+
+    for (int i = 0; i < STATS_HIST_SIZE; i++) {
+        sum += hist[i];
+        if (sum >= total * fraction) return i == 0 ? 0 : (1ull << i) - 1;
+    }
+
+    return 1ull << (STATS_HIST_SIZE - 1);
+}
+
+static void load_hist(unsigned long long *dst, const atomic_ullong *hist) {
+    for (int i = 0; i < STATS_HIST_SIZE; i++) dst[i] = atomic_load_explicit(&hist[i], memory_order_relaxed);
+}
+
+static void print_pins(const gpio_stats_t *stats, unsigned long long *lastEdges, double interval) {
+    unsigned long long hist[STATS_HIST_SIZE];
+    unsigned long long edges;
+
+    printf("%-4s %12s %10s %9s %7s %12s %10s %8s %8s\n", "pin", "edges", "edges/s", "timeouts", "errors",
+           "measurements", "freq Hz", "p50 us", "p99 us");
+    for (int pin = 0; pin < STATS_PINS; pin++) {
+        const stats_pin_t *p = &stats->pins[pin];
+
+        edges = atomic_load_explicit(&p->edges, memory_order_relaxed);
+        if (edges == 0 && atomic_load_explicit(&p->timeouts, memory_order_relaxed) == 0
+            && atomic_load_explicit(&p->measurements, memory_order_relaxed) == 0)
+            continue;
+
+        load_hist(hist, p->latency);
+        printf("%-4d %12llu %10.0f %9llu %7llu %12llu %10.2f %8llu %8llu\n", pin, edges,
+               interval > 0 ? (edges - lastEdges[pin]) / interval : 0.0,
+               atomic_load_explicit(&p->timeouts, memory_order_relaxed),
+               atomic_load_explicit(&p->errors, memory_order_relaxed),
+               atomic_load_explicit(&p->measurements, memory_order_relaxed),
+               atomic_load_explicit(&p->lastFreq, memory_order_relaxed) / 1000.0,
+               hist_percentile(hist, 0.5), hist_percentile(hist, 0.99));
+        lastEdges[pin] = edges;
+    }
+}
+
+static void print_tasks(const gpio_stats_t *stats) {
+    unsigned int count = atomic_load(&stats->taskCount);
+    unsigned long long hist[STATS_HIST_SIZE];
+    stats_task_t task;
+
+    printf("\n%-16s %10s %9s %9s %12s %8s %8s\n", "task", "releases", "overruns", "misses", "max resp us",
+           "p50 us", "p99 us");
+    for (unsigned int i = 0; i < count && i < STATS_TASKS; i++) {
+        // the histogram is outside of the seqlock and read directly from the segment
+        stats_read(&stats->tasks[i].seq, &task, &stats->tasks[i], offsetof(stats_task_t, response));
+        load_hist(hist, stats->tasks[i].response);
+        printf("%-16.*s %10llu %9llu %9llu %12llu %8llu %8llu\n", STATS_NAME_LEN, task.name,
+               (unsigned long long) task.releases, (unsigned long long) task.overruns,
+               (unsigned long long) task.deadlineMisses, (unsigned long long) task.maxResponse,
+               hist_percentile(hist, 0.5), hist_percentile(hist, 0.99));
+    }
+}
+
+static void print_zones(const gpio_stats_t *stats) {
+    unsigned int count = atomic_load(&stats->zoneCount);
+    stats_measurement_t measurement;
+    stats_dose_t dose;
+
+    printf("\n%-16s %8s %10s %10s %4s %6s %8s %10s %8s %9s %6s\n", "zone", "samples", "freq Hz", "filtered",
+           "dry", "runs", "cutoffs", "pump s", "edges", "overshoot", "early");
+    for (unsigned int i = 0; i < count && i < STATS_ZONES; i++) {
+        const stats_zone_t *zone = &stats->zones[i];
+
+        stats_read(&zone->measurement.seq, &measurement, &zone->measurement, sizeof measurement);
+        stats_read(&zone->dose.seq, &dose, &zone->dose, sizeof dose);
+        printf("%-16.*s %8llu %10.2f %10.2f %4s %6llu %8llu %10.1f %8lld %9lld %6lld\n", STATS_NAME_LEN,
+               zone->name, (unsigned long long) measurement.measurements, measurement.freq / 1000.0,
+               measurement.filtered / 1000.0, measurement.dry ? "yes" : "no", (unsigned long long) dose.runs,
+               (unsigned long long) dose.cutoffs, dose.pumpTime / 1e6, (long long) dose.lastEdges,
+               (long long) dose.overshoot, (long long) dose.earlyStop);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *file = STATS_FILE;
+    unsigned long long lastEdges[STATS_PINS] = {0};
+    const gpio_stats_t *stats;
+    double interval = 0;
+    int rounds = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:i:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                file = optarg;
+                break;
+            case 'i':
+                interval = atof(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if ((stats = stats_map(file)) == NULL) return 1;
+
+    while (1) {
+        printf("pid %d, up %lld s\n\n", stats->pid, (long long) (time(NULL) - stats->startTime));
+        // the first print has no rates
+        print_pins(stats, lastEdges, rounds++ ? interval : 0);
+        print_tasks(stats);
+        print_zones(stats);
+        fflush(stdout);
+
+        if (interval <= 0) return 0;
+        usleep((useconds_t) (interval * 1000000));
+        printf("\n");
+    }
+}
@@ -0,0 +1,260 @@
+#include <string.h>
+
+#include "irrigation.h"
+
+static zone_t *zones;
+static int zoneCount;
+static zone_t *zoneOfFlowPin[GPIO_COUNT];
+
+// median of 3 gates per measurement, smoothed with weight 1/2, single jumps by more than 25 % are rejected
+static const filter_config_t defaultFilter = {3, 1, 25, 2};
+
+// weight of the last overshoot in the early stop is 1 / 2^DOSE_ADAPT_SHIFT
+#define DOSE_ADAPT_SHIFT 2
+
+static atomic_int activePumps;
+static int nextMeasurement;
+static int nextPump;
+
+// End the watering of zone, may be called concurrently by the flow ISR and the scheduler.
+// Returns false if the zone wasn't watering (anymore), otherwise the caller switches the pump off.
+// The flow counter keeps counting until the run has settled.
+static bool end_watering(zone_t *zone, bool cutoff) {
+    bool expected = true;
+
+    if (!atomic_compare_exchange_strong(&zone->watering, &expected, false)) return false;
+
+    atomic_store(&zone->dose.cutoff, cutoff);
+    atomic_store(&zone->dose.stopTime, get_clock_time());
+    atomic_store(&zone->dry, false);
+    atomic_store(&zone->watered, true);
+    atomic_fetch_sub(&activePumps, 1);
+    RTLOG("%s: pump stopped after %d edges\n", zone->name, atomic_load(&zone->waterCount));
+
+    return true;
+}
+
+// Prepare the watering of zone, the caller switches the pump on
+static void begin_watering(zone_t *zone, long milliliters) {
+    int edges = (int) (milliliters * RISING_EDGE_PER_LITRE / 1000);
+    int target = edges - zone->dose.earlyStop;
+
+    RTLOG("%s: starting pump for %d edges\n", zone->name, target < 1 ? 1 : target);
+    atomic_store(&zone->dose.target, target < 1 ? 1 : target);
+    atomic_store(&zone->waterCount, 0);
+    zone->pumpStart = get_clock_time();
+    atomic_fetch_add(&activePumps, 1);
+    atomic_store(&zone->watering, true);
+}
+
+// Account a settled run in the stats segment, only called by the pump scheduler
+static void publish_dose(zone_t *zone) {
+    stats_dose_t *stats;
+
+    if (zone->stats == nullptr) return;
+    stats = &zone->stats->dose;
+
+    stats_write_begin(&stats->seq);
+    stats->runs++;
+    if (atomic_load(&zone->dose.cutoff)) stats->cutoffs++;
+    stats->pumpTime += atomic_load(&zone->dose.stopTime) - zone->pumpStart;
+    stats->lastEdges = atomic_load(&zone->waterCount);
+    stats->overshoot = zone->dose.overshoot;
+    stats->earlyStop = zone->dose.earlyStop;
+    stats_write_end(&stats->seq);
+}
+
+// Publish the last measurement of zone, only called by the measuring thread
+static void publish_measurement(zone_t *zone, double freq, fixed_t filtered) {
+    stats_measurement_t *stats;
+
+    if (zone->stats == nullptr) return;
+    stats = &zone->stats->measurement;
+
+    stats_write_begin(&stats->seq);
+    stats->measurements++;
+    stats->freq = (int64_t) (freq * 1000);
+    stats->filtered = filtered * 1000 / (1 << FILTER_FRAC_BITS);
+    stats->dry = atomic_load(&zone->dry);
+    stats_write_end(&stats->seq);
+}
+
+// Stop counting the flow of a run which settled and adapt the early stop to its overshoot
+static void finish_dose(zone_t *zone, long milliliters) {
+    dose_t *dose = &zone->dose;
+    int maxEarlyStop = (int) (milliliters * RISING_EDGE_PER_LITRE / 1000) / 2;
+
+    deactivate(&zone->flowActivation);
+    if (atomic_load(&dose->cutoff)) {
+        dose->overshoot = atomic_load(&zone->waterCount) - atomic_load(&dose->target);
+        dose->earlyStop += (dose->overshoot - dose->earlyStop) / (1 << DOSE_ADAPT_SHIFT);
+        if (dose->earlyStop < 0) dose->earlyStop = 0;
+        if (dose->earlyStop > maxEarlyStop) dose->earlyStop = maxEarlyStop;
+    }
+    publish_dose(zone);
+    series_append(&zone->flow, (double) atomic_load(&zone->waterCount) * 1000 / RISING_EDGE_PER_LITRE);
+    atomic_store(&dose->stopTime, 0);
+    if (!atomic_load(&dose->cutoff)) return;
+
+    RTLOG("%s: %d edges overshoot, stopping %d edges early\n", zone->name, dose->overshoot, dose->earlyStop);
+}
+
+static void flow_isr(int pin, int level) {
+    zone_t *zone = zoneOfFlowPin[pin];
+
+    // the pump is switched off before anything else happens
+    if (level == GPIO_ON && atomic_fetch_add(&zone->waterCount, 1) + 1 == atomic_load(&zone->dose.target)) {
+        gpio_set(zone->pumpMask);
+        end_watering(zone, true);
+    }
+}
+
+int init_zones(zone_t *table, int count, int sensorPriority, int flowPriority,
+               cpu_set_t *cpuset, cpu_set_t *housekeeping) {
+    const char *files[MAX_ZONES];
+    int err;
+
+    if (count > MAX_ZONES) return -1;
+
+    zones = table;
+    zoneCount = count;
+
+    for (int i = 0; i < count; i++) files[i] = zones[i].configFile;
+    if (watch_config(files, count, housekeeping) == -1) return -1;
+
+    for (int i = 0; i < count; i++) {
+        zone_t *zone = &zones[i];
+
+        if (zone->sensorPin >= GPIO_COUNT || zone->flowPin >= GPIO_COUNT || zone->pumpPin >= GPIO_COUNT) {
+            printf("%s: pin out of range\n", zone->name);
+            return -1;
+        }
+
+        // map the logs before the RT threads start so appending never touches the file system
+        if (open_freq_log(&zone->log, zone->logFile) == -1
+            || open_series(&zone->humidity, zone->humidityFile) == -1
+            || open_series(&zone->flow, zone->flowFile) == -1)
+            return -1;
+
+        zone->sensorActivation = (activation_t) ACTIVATION_INITIALIZER;
+        zone->flowActivation = (activation_t) ACTIVATION_INITIALIZER;
+        zoneOfFlowPin[zone->flowPin] = zone;
+        filter_init(&zone->filter, zone->filterConfig != nullptr ? zone->filterConfig : &defaultFilter);
+
+        zone->pumpMask = GPIO_MASK(zone->pumpPin);
+
+        if (gpioStats != nullptr && i < STATS_ZONES) {
+            zone->stats = &gpioStats->zones[i];
+            strncpy(zone->stats->name, zone->name, STATS_NAME_LEN - 1);
+            atomic_store(&gpioStats->zoneCount, i + 1);
+        }
+
+        gpio_input(zone->sensorPin);
+        gpio_input(zone->flowPin);
+
+        // stop pump before it becomes an output
+        gpio_set(zone->pumpMask);
+        gpio_output(zone->pumpPin);
+
+        if ((err = init_isr_func(zone->flowPin, EDGE_RISING, flow_isr, &zone->flowActivation, cpuset, flowPriority))
+            || (err = init_isr_func(zone->sensorPin, EDGE_RISING, freq_counter, &zone->sensorActivation, cpuset,
+                                    sensorPriority))) {
+            printf("%s: failed to start ISR: %d\n", zone->name, err);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void measure_next_zone() {
+    zone_t *zone = &zones[nextMeasurement];
+    const struct config_data *config = get_config(nextMeasurement);
+    fixed_t gates[FILTER_MAX_MEDIAN];
+    int count = 0;
+    fixed_t filtered;
+    double freq;
+    bool dry;
+
+    nextMeasurement = (nextMeasurement + 1) % zoneCount;
+
+    // the samples before the watering don't tell anything about the soil anymore, the decision stays
+    if (atomic_exchange(&zone->watered, false)) filter_restart(&zone->filter);
+
+    // short gates right after each other, their median is the measurement of this period
+    for (int i = 0; i < zone->filter.config->medianLength && i < FILTER_MAX_MEDIAN; i++) {
+        freq = read_input_freq_reciprocal(zone->sensorPin, ZONE_SAMPLE_TIME, &zone->sensorActivation) * 16;
+        // less than two edges inside the gate
+        if (freq > 0) gates[count++] = TO_FIXED(freq);
+    }
+
+    if (count == 0) {
+        RTLOG("%s: no signal\n", zone->name);
+        send_freq_to_ui(&zone->log, 0);
+        publish_measurement(zone, 0, 0);
+        return;
+    }
+
+    freq = FROM_FIXED(filter_median(gates, count));
+    send_freq_to_ui(&zone->log, freq);
+    series_append(&zone->humidity, freq);
+    filtered = filter_push(&zone->filter, gates, count);
+#ifdef VERBOSE
+    RTLOG("%s: %.2f Hz, filtered %.2f Hz\n", zone->name, freq, FROM_FIXED(filtered));
+#endif
+
+    // dry until the filtered value falls below humid, so a zone is watered again after it
+    // settled until the soil is humid
+    dry = filter_is_dry(&zone->filter, config->arid, config->humid);
+    if (!atomic_load(&zone->watering)) atomic_store(&zone->dry, dry);
+    publish_measurement(zone, freq, filtered);
+}
+
+void stop_pumps() {
+    gpio_mask_t pumps = 0;
+
+    for (int i = 0; i < zoneCount; i++) pumps |= zones[i].pumpMask;
+    gpio_set(pumps);
+}
+
+void schedule_pumps(uint64_t maxPumpTime, int maxActivePumps) {
+    uint64_t now = get_clock_time();
+    gpio_mask_t stop = 0, start = 0;
+
+    // stop pumping because of deadline
+    for (int i = 0; i < zoneCount; i++) {
+        if (atomic_load(&zones[i].watering) && now - zones[i].pumpStart >= maxPumpTime
+            && end_watering(&zones[i], false)) {
+            stop |= zones[i].pumpMask;
+        }
+    }
+    if (stop) gpio_set(stop);
+
+    for (int i = 0; i < zoneCount; i++) {
+        uint64_t stopTime = atomic_load(&zones[i].dose.stopTime);
+        if (stopTime != 0 && now - stopTime >= DOSE_SETTLE_TIME) finish_dose(&zones[i], get_config(i)->milliliters);
+    }
+
+    // start dry zones round robin, so every zone gets its turn if the pumps are limited
+    for (int n = 0; n < zoneCount && atomic_load(&activePumps) < maxActivePumps; n++) {
+        zone_t *zone = &zones[nextPump];
+
+        nextPump = (nextPump + 1) % zoneCount;
+        // a zone can only start again when its last run settled
+        if (atomic_load(&zone->dry) && !atomic_load(&zone->watering) && atomic_load(&zone->dose.stopTime) == 0) {
+            begin_watering(zone, get_config((int) (zone - zones))->milliliters);
+            start |= zone->pumpMask;
+        }
+    }
+    if (start == 0) return;
+
+    // the flow counters listen before the pumps run, so no edge of the dose is missed
+    for (int i = 0; i < zoneCount; i++) {
+        if (start & zones[i].pumpMask) {
+            activate(&zones[i].flowActivation);
+            arm_isr(zones[i].flowPin);
+        }
+    }
+    // all pumps of this cycle start with one store
+    gpio_clr(start);
+}
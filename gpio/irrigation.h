@@ -0,0 +1,75 @@
+#ifndef GPIO_IRRIGATION_H
+#define GPIO_IRRIGATION_H
+
+#include "gpio.h"
+#include "ui.h"
+#include "filter.h"
+#include "stats.h"
+#include "series.h"
+
+#define MAX_ZONES MAX_CONFIGS
+
+// The datasheet says 5880 square waves per litre but I measured something different
+#define RISING_EDGE_PER_LITRE 4880
+
+// edges which are still counted after the pump was stopped to measure the overshoot, in us
+#define DOSE_SETTLE_TIME (2 * 1000000ull)
+
+// gate in us, a humidity measurement takes the median of several of them (filter_config_t.medianLength)
+#define ZONE_SAMPLE_TIME 2500
+
+// Dosing of one zone. The edge target is computed when the pump starts, so the flow ISR only
+// compares its count against it. The edges counted after the cutoff (overshoot) move the
+// cutoff of the next runs earlier.
+typedef struct {
+    atomic_int target; // edge at which the flow ISR stops the pump
+    int earlyStop; // edges the pump is stopped before the dose
+    int overshoot; // edges counted after the cutoff of the last run
+    atomic_ullong stopTime; // in us, 0 if no run is settling
+    atomic_bool cutoff; // the last run was stopped by the flow ISR and not by the deadline
+} dose_t;
+
+// One bed with its own sensor, flow counter, pump and calibration file
+typedef struct {
+    const char *name;
+    unsigned int sensorPin; // humidity sensor
+    unsigned int flowPin; // flow counter
+    unsigned int pumpPin; // pump, active low
+    const char *configFile; // thresholds and dose, see load_config()
+    const char *logFile; // frequency log for the UI
+    const char *humidityFile; // long-term history of the measurements, see series.h
+    const char *flowFile; // long-term history of the watered millilitres per run
+    const filter_config_t *filterConfig; // nullptr for the default filter
+
+    gpio_mask_t pumpMask; // GPIO_MASK(pumpPin)
+    freq_log_t log;
+    series_t humidity; // written by the measuring thread
+    series_t flow; // written by the pump scheduler
+    activation_t sensorActivation; // activates the ISR of sensorPin while measuring
+    activation_t flowActivation; // activates the ISR of flowPin while watering
+    atomic_int waterCount;
+    dose_t dose;
+    atomic_bool dry; // the last measurement asked for water
+    atomic_bool watering;
+    atomic_bool watered; // watering ended, the moving average starts again with the next measurement
+    uint64_t pumpStart; // in us
+    sensor_filter_t filter; // only used by the measuring thread
+    stats_zone_t *stats; // slot in the stats segment, nullptr without one
+} zone_t;
+
+// Set up the pins, logs and ISRs of all zones and publish their configs. The ISRs run on
+// cpuset, the config watcher on housekeeping.
+extern int init_zones(zone_t *zones, int count, int sensorPriority, int flowPriority,
+                      cpu_set_t *cpuset, cpu_set_t *housekeeping);
+
+// Measure the humidity of the next zone (round robin) and mark it dry if necessary
+extern void measure_next_zone();
+
+// Switch off the pumps of all zones at once, without accounting the doses
+extern void stop_pumps();
+
+// Stop pumps which ran longer than maxPumpTime us and start dry zones while less than
+// maxActivePumps pumps are running
+extern void schedule_pumps(uint64_t maxPumpTime, int maxActivePumps);
+
+#endif //GPIO_IRRIGATION_H
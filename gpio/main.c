@@ -6,222 +6,274 @@
 #include <sys/mman.h>
 #include <stdbool.h>
 #include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 
 #include "gpio.h"
 #include "ui.h"
 #include "realtime.h"
-
-// humidity sensor
-#define HUMIDITY_SENSOR 17
-// flow counter
-#define FLOW_SENSOR 18
-// pump
-#define PUMP 27
-
-#define PERIODE_DURATION 120
-#define MAIN_PRIO 90
-#define WATER_COUNT_PRIO 80
-#define RELOAD_CONFIG_PRIO 60
-#define CHECK_HUMIDITY_PRIO 75
-#define READ_HUMIDITY_FREQUENCY_PRIO 70
-
-// The datasheet says 5880 square waves per litre but I measured something different
-#define RISING_EDGE_PER_LITRE 4880
-
-volatile int water_count = 0;
-bool isWatering = false;
-struct config_data config;
-
-cpu_set_t cpuset;
-cond_wait_t checkHumidityCond = {false, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
-cond_wait_t reloadConfigCond = {false, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
-cond_wait_t waterCountCond = {false, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
-cond_wait_t readFrequencyCond = {false, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
-
-void water_count_isr(int pin, int level) {
-    if (level == GPIO_ON) {
-        water_count++;
-        printf(".");
-
-        if (((double) water_count / RISING_EDGE_PER_LITRE) * (double) 1000 >= config.milliliters) {
-            // stop pump
-            GPIO_SET |= 1 << PUMP;
-            waterCountCond.cond = false;
-            isWatering = false;
-        }
+#include "cyclic.h"
+#include "irrigation.h"
+#include "rtmem.h"
+#include "stats.h"
+
+// in us
+#define PERIODE_DURATION (120 * 1000000ull)
+#define HUMIDITY_DEADLINE (1 * 1000000ull)
+#define PUMP_PERIOD (1 * 1000000ull)
+#define REPORT_PERIOD (10 * PERIODE_DURATION)
+// a pump is stopped after this time even if the flow counter did not reach the dose
+#define MAX_PUMP_TIME PERIODE_DURATION
+// pumps which may run at the same time, limited by the water supply
+#define MAX_ACTIVE_PUMPS 2
+
+// the RT threads run on the isolated CPUs 2 and 3, the log output and the config watcher on CPU 0
+#define HOUSEKEEPING_CPU 0
+#define CONTROL_CPU 2
+#define ISR_CPU 3
+
+#define UI_DIR "/home/pi/gpio_data/"
+// written on SIGUSR1 in the format of the cyclictest runs in benchmarks/
+#define LATENCY_FILE "latency.txt"
+
+// humidity sensor, flow counter, pump (active low), calibration, frequency log and long-term histories
+zone_t zones[] = {
+        {"bed", 17, 18, 27, "calibration.csv", "hydro.bin", "humidity.tsd", "flow.tsd"},
+};
+#define ZONE_COUNT (sizeof zones / sizeof zones[0])
+
+enum {
+    PLAN_EXECUTIVE, PLAN_ISR, PLAN_HUMIDITY, PLAN_HOUSEKEEPING
+};
+
+// core, policy and priority of every thread
+const thread_plan_t threadPlan[] = {
+        [PLAN_EXECUTIVE] = {"executive", CONTROL_CPU, SCHED_FIFO, 90},
+        [PLAN_ISR] = {"isr dispatcher", ISR_CPU, SCHED_FIFO, 80},
+        [PLAN_HUMIDITY] = {"humidity", CONTROL_CPU, SCHED_FIFO, 75},
+        [PLAN_HOUSEKEEPING] = {"housekeeping", HOUSEKEEPING_CPU, SCHED_OTHER, 0},
+};
+
+// the same threads under SCHED_DEADLINE (-d): the kernel admits their budgets instead of relying on
+// priorities, the budgets follow the measured execution times. Runtime, deadline and period in us.
+const thread_plan_t deadlinePlan[] = {
+        [PLAN_EXECUTIVE] = {"executive", CONTROL_CPU, SCHED_DEADLINE, 0, 0, 1000, PUMP_PERIOD},
+        [PLAN_ISR] = {"isr dispatcher", CONTROL_CPU, SCHED_DEADLINE, 0, 0, 10000, 10000},
+        [PLAN_HUMIDITY] = {"humidity", CONTROL_CPU, SCHED_DEADLINE, 0, 0, HUMIDITY_DEADLINE, HUMIDITY_DEADLINE},
+        [PLAN_HOUSEKEEPING] = {"housekeeping", HOUSEKEEPING_CPU, SCHED_OTHER, 0},
+};
+
+// threadPlan or deadlinePlan
+const thread_plan_t *activePlan = threadPlan;
+
+cpu_set_t isrCpuset;
+cpu_set_t housekeepingCpuset;
+activation_t checkHumidityActivation = ACTIVATION_INITIALIZER;
+
+void pump_task();
+void report_schedule();
+
+enum {
+    TASK_HUMIDITY, TASK_PUMPS, TASK_REPORT
+};
+
+// every zone is measured once per period, the measurements are staggered over the period
+cyclic_task_t tasks[] = {
+        [TASK_HUMIDITY] = {"humidity", nullptr, &checkHumidityActivation, PERIODE_DURATION / ZONE_COUNT, 0,
+                           HUMIDITY_DEADLINE},
+        [TASK_PUMPS] = {"pumps", pump_task, nullptr, PUMP_PERIOD, 0, PUMP_PERIOD},
+        [TASK_REPORT] = {"report", report_schedule, nullptr, REPORT_PERIOD, REPORT_PERIOD, REPORT_PERIOD},
+};
+cyclic_table_t schedule = {tasks, sizeof tasks / sizeof tasks[0]};
+
+// Measures one zone per activation, so the number of zones doesn't change the number of threads
+_Noreturn void check_humidity() {
+    while (1) {
+        take_activation(&checkHumidityActivation);
+        latency_record(atomic_load(&checkHumidityActivation.signalTime));
+        PRINT_START(8)
+        RTMEM_CHECK();
+        measure_next_zone();
+        PRINT_END(8)
+        cyclic_task_done(&tasks[TASK_HUMIDITY]);
+        // the CPU time of the measurement, reported by report_schedule()
+        exec_time_record();
     }
 }
 
-_Noreturn void reload_config() {
-#ifdef TIMER
-    struct timespec startTime, endTime, diffTime;
-    clockid_t threadClockId;
-    pthread_getcpuclockid(pthread_self(), &threadClockId);
-#endif
-    while (1) {
-        pthread_mutex_lock(&reloadConfigCond.pthreadMutex);
-        while (!reloadConfigCond.cond)
-            pthread_cond_wait(&reloadConfigCond.pthreadCond, &reloadConfigCond.pthreadMutex);
-        PRINT_START(4)
-#ifdef TIMER
-        clock_gettime(threadClockId, &startTime);
-#endif
-        reloadConfigCond.cond = false;
-        load_config(&config);
-#ifdef VERBOSE
-        printf("%ld - %ld - %ld\n", config.arid, config.humid, config.milliliters);
-#endif
-#ifdef TIMER
-        clock_gettime(threadClockId, &endTime);
-        diffTime = diff(startTime, endTime);
-        printf("Config Thread time: %ld:%ld\n", diffTime.tv_sec, diffTime.tv_nsec);
-#endif
-        PRINT_END(4)
-        pthread_mutex_unlock(&reloadConfigCond.pthreadMutex);
-    }
+void pump_task() {
+    schedule_pumps(MAX_PUMP_TIME, MAX_ACTIVE_PUMPS);
 }
 
-_Noreturn void check_humidity() {
-#ifdef TIMER
-    struct timespec startTime, endTime, diffTime;
-    clockid_t threadClockId;
-    pthread_getcpuclockid(pthread_self(), &threadClockId);
-#endif
-    double freq;
-    while (1) {
-        pthread_mutex_lock(&checkHumidityCond.pthreadMutex);
-        while (!checkHumidityCond.cond)
-            pthread_cond_wait(&checkHumidityCond.pthreadCond, &checkHumidityCond.pthreadMutex);
-        PRINT_START(8)
-#ifdef TIMER
-        clock_gettime(threadClockId, &startTime);
-#endif
-        checkHumidityCond.cond = false;
-        //get frequency from sensor
-        freq = read_input_freq(HUMIDITY_SENSOR, DEFAULT_SAMPLE_TIME, &readFrequencyCond) * 16;
-#ifdef VERBOSE
-        printf("%.2f Hz\n", freq);
-#endif
-        send_freq_to_ui(freq);
+void report_schedule() {
+    cyclic_report(&schedule);
+    exec_report();
+    RTLOG("%lu page faults in RT threads\n", rtmem_faults());
+}
 
-        if (freq > config.arid && !waterCountCond.cond) {
-            waterCountCond.cond = true;
-        }
-#ifdef TIMER
-        clock_gettime(threadClockId, &endTime);
-        diffTime = diff(startTime, endTime);
-        printf("Humidity Thread time: %ld:%ld\n", diffTime.tv_sec, diffTime.tv_nsec);
-#endif
-        PRINT_END(8)
-        pthread_mutex_unlock(&checkHumidityCond.pthreadMutex);
-    }
+// The executive only returns if its timer failed. Nothing would stop the pumps after that, so
+// they are switched off and the controller ends.
+void run_schedule() {
+    cyclic_executive(&schedule);
+    stop_pumps();
+    RTLOG("pumps switched off, exiting\n");
+    usleep(2 * RTLOG_DRAIN_PERIOD);
+    exit(1);
 }
 
-void startAllThreads() {
-    checkHumidityCond.cond = true;
-    reloadConfigCond.cond = true;
-    pthread_cond_signal(&checkHumidityCond.pthreadCond);
-    pthread_cond_signal(&reloadConfigCond.pthreadCond);
-    if (waterCountCond.cond && !isWatering) {
-        isWatering = true;
-        printf("Starting pump thread\n");
-        water_count = 0;
-        GPIO_CLR |= 1 << PUMP;
-        pthread_cond_signal(&waterCountCond.pthreadCond);
-    }
+// edge trace which is replayed instead of reading the sensors (-r) and its speed (-s)
+const char *replayFile;
+double replaySpeed = 1;
+
+// Feeds the recorded edges to the ISRs of the zones, then the controller keeps running without edges
+void replay_trace() {
+    long edges = replay_edge_trace(replayFile, replaySpeed);
+    RTLOG("replayed %ld edges of %s\n", edges, replayFile);
 }
 
-_Noreturn void main_thread() {
-#ifdef TIMER
-    struct timespec startTime, endTime, diffTime;
-    clockid_t threadClockId;
-    pthread_getcpuclockid(pthread_self(), &threadClockId);
-#endif
+static void usage() {
+    printf("usage: gpio [-d] [-t trace] [-r trace [-s speed]]\n"
+           "\n"
+           "  -d        run the RT threads under SCHED_DEADLINE with budgets from their execution times\n"
+           "  -t trace  record all edges of the zones into trace\n"
+           "  -r trace  replay the edges of trace instead of reading the sensors, the pumps\n"
+           "            are switched in the simulated GPIO block\n"
+           "  -s speed  replay speed, 2 is twice as fast, 0 as fast as possible (default 1)\n");
+}
+
+// Write the wakeup latency histograms of all RT threads on every SIGUSR1
+_Noreturn void dump_latency_on_signal(sigset_t *signals) {
+    FILE *fp;
+    int sig;
+
     while (1) {
-#ifdef TIMER
-        clock_gettime(threadClockId, &startTime);
-#endif
-		printf("============================\n");
-        startAllThreads();
-        sleep(PERIODE_DURATION);
-        // stop pumping because of deadline
-        if(isWatering)
-        {
-            GPIO_SET |= 1 << PUMP;
-            waterCountCond.cond = false;
-            isWatering = false;
+        if (sigwait(signals, &sig) != 0) continue;
+
+        if ((fp = fopen(UI_DIR LATENCY_FILE, "w")) == NULL) {
+            perror("fopen");
+            continue;
         }
-#ifdef TIMER
-        clock_gettime(threadClockId, &endTime);
-        diffTime = diff(startTime, endTime);
-        printf("Main Thread time: %ld:%ld\n", diffTime.tv_sec, diffTime.tv_nsec);
-#endif
+        dump_latency_histograms(fp);
+        fclose(fp);
     }
 }
 
 int main(int argc, char *argv[]) {
     pthread_t checkHumidityPThread;
-    pthread_t configReloadPThread;
     pthread_t mainPThread;
+    pthread_t replayPThread;
+    const char *traceFile = nullptr;
+    sigset_t signals;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dt:r:s:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                activePlan = deadlinePlan;
+                break;
+            case 't':
+                traceFile = optarg;
+                break;
+            case 'r':
+                replayFile = optarg;
+                break;
+            case 's':
+                replaySpeed = atof(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // lock memory to not get swapped and prepare the heap before anything is mapped or allocated
+    if (rtmem_init(RTMEM_HEAP_PREFAULT) == -1) {
+        printf("Failed to prepare memory\n");
+        return 1;
+    }
 
-    CPU_ZERO(&cpuset);
-    CPU_SET(3, &cpuset);
+    // counters for gpiostat, the controller also runs without them
+    if (stats_create(STATS_FILE) == -1) {
+        printf("Failed to create %s, running without live statistics\n", STATS_FILE);
+    }
 
+    // only the main thread handles SIGUSR1, all threads inherit the mask
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-    // make sure calibration.csv and test-hydro.csv exist in this directory
-    // don't forget the trailing slash in the path!
-    set_ui_dir("/home/pi/gpio_data/");
+    isrCpuset = plan_cpuset(&threadPlan[PLAN_ISR]);
+    housekeepingCpuset = plan_cpuset(&threadPlan[PLAN_HOUSEKEEPING]);
 
-    // initial config load to make sure variable is set
-    load_config(&config);
+    // make sure the calibration files of all zones exist in this directory
+    // don't forget the trailing slash in the path!
+    set_ui_dir(UI_DIR);
 
     //initialize gpios
-    if (map_peripherals() == -1) {
+#ifdef GPIO_SIM
+    if (map_sim_peripherals(GPIO_SIM_FILE) == -1) {
+#else
+    // a replay must not switch the real pumps
+    if ((replayFile != nullptr ? map_sim_peripherals(GPIO_SIM_FILE) : map_peripherals()) == -1) {
+#endif
         printf("Fehler beim Mapping des physikalischen GPIO-Registers in den virtuellen Speicherbereich.\n");
         return 1;
     }
 
-    // lock memory to not get swapped
-    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
-        printf("mlockall failed: %m\n");
+    // RT threads only queue their log records, this thread prints them
+    if (rtlog_start(&housekeepingCpuset)) {
+        printf("Failed to start log thread\n");
         return 1;
     }
 
-    thread_t configReloadThread = {reload_config, nullptr};
-    if (start_realtime_thread(&configReloadPThread, &configReloadThread, &cpuset, RELOAD_CONFIG_PRIO)) {
-        printf("Failed to start RT configReloadThread");
-        return 1;
-    }
+    // the RT threads wait at the startup barrier until all of them are placed
+    hold_thread_startup();
 
     thread_t checkHumidityThread = {check_humidity, nullptr};
-    if (start_realtime_thread(&checkHumidityPThread, &checkHumidityThread, &cpuset, CHECK_HUMIDITY_PRIO)) {
-        printf("Failed to start RT checkHumidityThread");
+    if (start_planned_thread(&checkHumidityPThread, &checkHumidityThread, &activePlan[PLAN_HUMIDITY])) {
+        printf("Failed to start RT checkHumidityThread\n");
         return 1;
     }
 
-    INP_GPIO(HUMIDITY_SENSOR);
-    INP_GPIO(FLOW_SENSOR);
+    if (replayFile != nullptr) {
+        set_isr_backend(ISR_BACKEND_REPLAY, nullptr);
 
-    INP_GPIO(PUMP);
-    OUT_GPIO(PUMP);
+        thread_t replayThread = {replay_trace, nullptr};
+        if (start_planned_thread(&replayPThread, &replayThread, &activePlan[PLAN_ISR])) {
+            printf("Failed to start replay thread\n");
+            return 1;
+        }
+    }
 
-    // stop pump
-    GPIO_SET |= 1 << PUMP;
+    if (traceFile != nullptr && start_edge_trace(traceFile, &housekeepingCpuset) == -1) {
+        printf("Failed to start edge trace\n");
+        return 1;
+    }
 
-    init_isr_func(FLOW_SENSOR, EDGE_RISING, water_count_isr, &waterCountCond, &cpuset, WATER_COUNT_PRIO);
-    init_isr_func(HUMIDITY_SENSOR, EDGE_RISING, freq_counter, &readFrequencyCond, &cpuset,
-                  READ_HUMIDITY_FREQUENCY_PRIO);
+    // one thread for the edges of all zones instead of two per zone, a replay feeds the pins itself
+    if (replayFile == nullptr && start_planned_isr_dispatcher(&activePlan[PLAN_ISR])) {
+        printf("Failed to start ISR dispatcher\n");
+        return 1;
+    }
 
+    // initial config load to make sure a snapshot is published, later changes are published by the watcher.
+    // Pins which the dispatcher can't take get their own SCHED_FIFO threads in both plans.
+    if (init_zones(zones, ZONE_COUNT, threadPlan[PLAN_ISR].priority, threadPlan[PLAN_ISR].priority, &isrCpuset,
+                   &housekeepingCpuset) == -1) {
+        printf("Failed to initialize zones\n");
+        return 1;
+    }
 
-    thread_t mainThread = {main_thread, nullptr};
-    if (start_realtime_thread(&mainPThread, &mainThread, &cpuset, MAIN_PRIO)) {
-        printf("Failed to start RT checkHumidityThread");
+    thread_t mainThread = {run_schedule, nullptr};
+    if (start_planned_thread(&mainPThread, &mainThread, &activePlan[PLAN_EXECUTIVE])) {
+        printf("Failed to start cyclic executive\n");
         return 1;
     }
-    
-    pthread_join(mainPThread, NULL);
 
-    return 0;
+    release_thread_startup();
+
+    // the RT threads run forever, this thread only serves the latency dumps
+    dump_latency_on_signal(&signals);
 }
 
 #pragma clang diagnostic pop
\ No newline at end of file
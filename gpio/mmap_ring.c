@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mmap_ring.h"
+
+void *map_ring_file(const char *path, size_t size) {
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+        perror("open");
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t) size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    return map;
+}
+
+static char *slot(const mmap_ring_t *ring, uint64_t n) {
+    return (char *) ring->slots + (n % ring->capacity) * ring->recordSize;
+}
+
+void mmap_ring_push(const mmap_ring_t *ring, const void *record) {
+    uint64_t n = atomic_load_explicit(ring->sequence, memory_order_relaxed);
+
+    memcpy(slot(ring, n), record, ring->recordSize);
+    // publishing the sequence makes the record visible for readers
+    atomic_store_explicit(ring->sequence, n + 1, memory_order_release);
+}
+
+uint64_t mmap_ring_oldest(const mmap_ring_t *ring, uint64_t sequence) {
+    return sequence > ring->capacity - 1 ? sequence - (ring->capacity - 1) : 0;
+}
+
+int mmap_ring_read(const mmap_ring_t *ring, uint64_t *next, void *records, int max) {
+    uint64_t sequence, first, count, lost;
+
+    sequence = atomic_load_explicit(ring->sequence, memory_order_acquire);
+    first = *next;
+
+    // older records are already overwritten, a sequence from before a restart of the ring starts over
+    if (first < mmap_ring_oldest(ring, sequence) || first > sequence) first = mmap_ring_oldest(ring, sequence);
+    count = sequence - first;
+    if (count > (uint64_t) max) count = max;
+
+    for (uint64_t i = 0; i < count; i++) {
+        memcpy((char *) records + i * ring->recordSize, slot(ring, first + i), ring->recordSize);
+    }
+    *next = first + count;
+
+    // drop records which the writer overwrote (or started to) while they were copied
+    atomic_thread_fence(memory_order_acquire);
+    sequence = atomic_load_explicit(ring->sequence, memory_order_relaxed);
+    lost = mmap_ring_oldest(ring, sequence) > first ? mmap_ring_oldest(ring, sequence) - first : 0;
+    if (lost > count) lost = count;
+    memmove(records, (char *) records + lost * ring->recordSize, (count - lost) * ring->recordSize);
+
+    return (int) (count - lost);
+}
@@ -0,0 +1,39 @@
+#ifndef GPIO_MMAP_RING_H
+#define GPIO_MMAP_RING_H
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Ring of fixed size records in a memory mapped file with one writer and any number of readers,
+// also in other processes. Record n is in slot n % capacity and is published by incrementing the
+// sequence, so the slot after the newest record may be written at any time and a ring holds
+// capacity - 1 valid records. Readers copy the records and then drop the ones the writer
+// wrapped onto in the meantime. The frequency log (ui.h) and the tiers of a series (series.h)
+// are such rings; the struct only describes where they are in the mapping.
+typedef struct {
+    atomic_ullong *sequence; // number of records written in total, inside the mapping
+    void *slots;
+    size_t recordSize;
+    uint32_t capacity;
+} mmap_ring_t;
+
+// Map size bytes of the file at path shared and read/write, creating and resizing it if
+// necessary. Returns NULL on errors.
+extern void *map_ring_file(const char *path, size_t size);
+
+// Append record in O(1), never blocks. Only touches the mapped pages, so it may be called from
+// RT threads once the file is mapped.
+extern void mmap_ring_push(const mmap_ring_t *ring, const void *record);
+
+// Sequence number of the oldest record which is still valid after sequence records were written
+extern uint64_t mmap_ring_oldest(const mmap_ring_t *ring, uint64_t sequence);
+
+// Copy up to max records from sequence number *next on (oldest first) into records and advance
+// *next behind them. Records which were overwritten before *next was reached are skipped.
+// Returns the number of records.
+extern int mmap_ring_read(const mmap_ring_t *ring, uint64_t *next, void *records, int max);
+
+#endif //GPIO_MMAP_RING_H
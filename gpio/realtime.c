@@ -1,23 +1,159 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "realtime.h"
+#include "rtmem.h"
+
+static latency_hist_t latencyHists[LATENCY_MAX_THREADS];
+static atomic_int latencyHistCount;
+static _Thread_local latency_hist_t *ownHist;
+// same index as the latency histogram of the thread
+static exec_stats_t execStats[LATENCY_MAX_THREADS];
+static _Thread_local exec_stats_t *ownExec;
+
+// struct sched_attr of the kernel, glibc has no wrapper for sched_setattr()
+struct deadline_attr {
+    uint32_t size;
+    uint32_t policy;
+    uint64_t flags;
+    int32_t nice;
+    uint32_t priority;
+    uint64_t runtime, deadline, period; // in ns
+};
+
+// startup barrier, the number of threads is only known when the barrier is released
+static atomic_bool startupHeld;
+static atomic_int startupStarted; // threads started while held
+static atomic_int startupWaiting; // threads at the barrier
+static activation_t startupArrived = ACTIVATION_INITIALIZER; // a thread reached the barrier
+static activation_t startupReleased = ACTIVATION_INITIALIZER;
+
+// Return monotonic clock time in us
+uint64_t get_clock_time() {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    else
+        return 0;
+}
+
+static uint64_t thread_cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Switch the calling thread to SCHED_DEADLINE, parameters in us
+static int set_deadline(uint64_t runtime, uint64_t deadline, uint64_t period) {
+    struct deadline_attr attr = {sizeof attr, SCHED_DEADLINE, 0, 0, 0,
+                                 runtime * 1000, deadline * 1000, period * 1000};
+
+    return syscall(SYS_sched_setattr, 0, &attr, 0) == -1 ? -1 : 0;
+}
+
+// Runtime the deadline thread of plan starts with
+static uint64_t initial_runtime(const thread_plan_t *plan) {
+    uint64_t runtime = plan->runtime ? plan->runtime : plan->deadline / DEADLINE_INITIAL_SHARE;
+
+    return runtime < DEADLINE_MIN_RUNTIME ? DEADLINE_MIN_RUNTIME : runtime;
+}
+
+// Claim a histogram and the execution time stats for the calling RT thread
+static void init_latency_hist(const thread_plan_t *plan) {
+    struct sched_param param;
+    int policy;
+    int index = atomic_fetch_add(&latencyHistCount, 1);
 
+    if (index >= LATENCY_MAX_THREADS) return;
+
+    ownHist = &latencyHists[index];
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    ownHist->priority = param.sched_priority;
+    atomic_store(&ownHist->min, UINT64_MAX);
+
+    ownExec = &execStats[index];
+    atomic_store(&ownExec->min, UINT64_MAX);
+    if (plan == nullptr) return;
+
+    ownExec->name = plan->name;
+    ownExec->deadline = plan->deadline;
+    ownExec->period = plan->period;
+    if (plan->policy == SCHED_DEADLINE) {
+        ownExec->autoBudget = plan->runtime == 0;
+        atomic_store(&ownExec->runtime, initial_runtime(plan) * 1000);
+    }
+}
+
+// Wait at the startup barrier while it is held
+static void wait_for_startup() {
+    if (!atomic_load(&startupHeld)) return;
+
+    atomic_fetch_add(&startupWaiting, 1);
+    activate(&startupArrived);
+    wait_activation(&startupReleased);
+}
 
 void *thread_start_helper(void *arg) {
-    // sleep to give system time to migrate thread to correct cpu
-    usleep(300);
+    thread_t *thread = arg;
+    const thread_plan_t *plan = thread->plan;
+
+    // pthread attributes know no SCHED_DEADLINE, the thread switches itself and reports the admission
+    if (plan != nullptr && plan->policy == SCHED_DEADLINE) {
+        thread->schedError = set_deadline(initial_runtime(plan), plan->deadline, plan->period) ? errno : 0;
+        activate(&thread->scheduled);
+        if (thread->schedError) return NULL;
+    }
+
+    init_latency_hist(plan);
+    rtlog_attach();
+    rtmem_prefault_stack();
+    wait_for_startup();
+    // faults from here on are reported in the checking mode, the startup is no job
+    rtmem_thread_ready();
+    if (ownExec != NULL) ownExec->lastCpu = thread_cpu_time();
 
     // call user defined thread function
-    thread_t *thread = arg;
     if (thread->arg == nullptr) {
         thread->func();
     } else {
         thread->func(thread->arg);
     }
+
+    return NULL;
 }
 
-int start_realtime_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset, int priority) {
+void hold_thread_startup() {
+    atomic_store(&startupStarted, 0);
+    atomic_store(&startupWaiting, 0);
+    deactivate(&startupReleased);
+    atomic_store(&startupHeld, true);
+}
+
+void release_thread_startup() {
+    // every arrival sets startupArrived again, so none is missed between the check and the wait
+    while (atomic_load(&startupWaiting) < atomic_load(&startupStarted)) take_activation(&startupArrived);
+    atomic_store(&startupHeld, false);
+    activate(&startupReleased);
+}
+
+static int start_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset, int policy, int priority) {
+    bool deadline = policy == SCHED_DEADLINE;
     struct sched_param param;
     pthread_attr_t attr;
+    int err;
+
+    // created as normal thread which then switches itself to SCHED_DEADLINE
+    if (deadline) {
+        policy = SCHED_OTHER;
+        priority = 0;
+        deactivate(&func->scheduled);
+    }
 
     // Initialize pthread attributes (default values)
     if (pthread_attr_init(&attr)) {
@@ -30,7 +166,7 @@ int start_realtime_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset,
     }
 
     // Set scheduler policy and priority of pthread
-    if (pthread_attr_setschedpolicy(&attr, SCHED_FIFO)) {
+    if (pthread_attr_setschedpolicy(&attr, policy)) {
         return ERROR_PTH_SETSCHEDPOLICY_FAILED;
     }
 
@@ -45,17 +181,54 @@ int start_realtime_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset,
         return ERROR_PTH_SETSCHEDPARAM_FAILED;
     }
 
-    // Start thread
-    if (pthread_create(pthread, &attr, thread_start_helper, func)) {
-        return ERROR_PTH_THREADCREATE_FAILED;
+    // Set CPU affinity, so the thread is created on its CPUs instead of being migrated afterwards.
+    // Deadline threads keep the affinity of the process, the kernel refuses them on a subset.
+    if (!deadline && pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpuset)) {
+        return ERROR_PTH_SETAFFINITY_FAILED;
     }
 
-    // Set CPU affinity
-    pthread_setaffinity_np(*pthread, sizeof(cpu_set_t), cpuset);
+    // Start thread, counted before it runs so a held barrier can't be released before it arrives
+    if (atomic_load(&startupHeld)) atomic_fetch_add(&startupStarted, 1);
+    err = pthread_create(pthread, &attr, thread_start_helper, func);
+    if (err && atomic_load(&startupHeld)) atomic_fetch_sub(&startupStarted, 1);
+
+    pthread_attr_destroy(&attr);
+
+    if (err) return ERROR_PTH_THREADCREATE_FAILED;
+
+    // the admission control of the kernel decides if the thread runs
+    if (deadline) {
+        take_activation(&func->scheduled);
+        if (func->schedError) {
+            if (atomic_load(&startupHeld)) atomic_fetch_sub(&startupStarted, 1);
+            pthread_join(*pthread, NULL);
+            return ERROR_PTH_SETDEADLINE_FAILED;
+        }
+    }
 
     return 0;
 }
 
+int start_realtime_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset, int priority) {
+    return start_thread(pthread, func, cpuset, SCHED_FIFO, priority);
+}
+
+cpu_set_t plan_cpuset(const thread_plan_t *plan) {
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(plan->cpu, &cpuset);
+
+    return cpuset;
+}
+
+int start_planned_thread(pthread_t *pthread, thread_t *func, const thread_plan_t *plan) {
+    cpu_set_t cpuset = plan_cpuset(plan);
+
+    func->plan = plan;
+    return start_thread(pthread, func, &cpuset, plan->policy, plan->priority);
+}
+
 struct timespec diff(struct timespec start, struct timespec end)
 {
     struct timespec temp;
@@ -68,3 +241,250 @@ struct timespec diff(struct timespec start, struct timespec end)
     }
     return temp;
 }
+
+static void futex(atomic_uint *word, int op, unsigned int value) {
+    syscall(SYS_futex, word, op | FUTEX_PRIVATE_FLAG, value, NULL, NULL, 0);
+}
+
+void activate(activation_t *activation) {
+    atomic_store_explicit(&activation->signalTime, get_clock_time(), memory_order_relaxed);
+    if (atomic_exchange_explicit(&activation->state, ACTIVATION_ACTIVE, memory_order_acq_rel) & ACTIVATION_WAITERS)
+        futex(&activation->state, FUTEX_WAKE, INT_MAX);
+}
+
+void deactivate(activation_t *activation) {
+    atomic_fetch_and_explicit(&activation->state, ~ACTIVATION_ACTIVE, memory_order_release);
+}
+
+bool wait_activation_or_stop(activation_t *activation, atomic_bool *stop) {
+    unsigned int state = atomic_load_explicit(&activation->state, memory_order_acquire);
+
+    while (!(state & ACTIVATION_ACTIVE)) {
+        if (stop != NULL && atomic_load(stop)) return false;
+
+        // announce the sleep, activate() only wakes if the flag is set
+        if (!(state & ACTIVATION_WAITERS)
+            && !atomic_compare_exchange_weak_explicit(&activation->state, &state, state | ACTIVATION_WAITERS,
+                                                      memory_order_acq_rel, memory_order_acquire))
+            continue;
+
+        // returns at once if the state changed since it was read, also by a kick after stop was set
+        futex(&activation->state, FUTEX_WAIT, state | ACTIVATION_WAITERS);
+        state = atomic_load_explicit(&activation->state, memory_order_acquire);
+    }
+
+    return true;
+}
+
+void wait_activation(activation_t *activation) {
+    wait_activation_or_stop(activation, NULL);
+}
+
+void kick_activation(activation_t *activation) {
+    // a new generation makes a FUTEX_WAIT which is about to start return at once
+    if (atomic_fetch_add_explicit(&activation->state, ACTIVATION_KICK, memory_order_acq_rel) & ACTIVATION_WAITERS)
+        futex(&activation->state, FUTEX_WAKE, INT_MAX);
+}
+
+void take_activation(activation_t *activation) {
+    unsigned int state;
+
+    while (1) {
+        wait_activation(activation);
+        state = atomic_fetch_and_explicit(&activation->state, ~ACTIVATION_ACTIVE, memory_order_acq_rel);
+        if (state & ACTIVATION_ACTIVE) return;
+    }
+}
+
+// Only the owning thread writes its histogram, so plain loads and stores are enough
+static void add(atomic_ulong *value, unsigned long n) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void add64(atomic_ullong *value, uint64_t n) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void latency_record(uint64_t intended) {
+    latency_hist_t *hist = ownHist;
+    uint64_t time = get_clock_time();
+    uint64_t latency;
+    unsigned long cycle;
+
+    if (hist == NULL) return;
+
+    latency = time > intended ? time - intended : 0;
+    cycle = atomic_load_explicit(&hist->cycles, memory_order_relaxed);
+    add(&hist->cycles, 1);
+    add64(&hist->sum, latency);
+    if (latency < atomic_load_explicit(&hist->min, memory_order_relaxed))
+        atomic_store_explicit(&hist->min, latency, memory_order_relaxed);
+    if (latency > atomic_load_explicit(&hist->max, memory_order_relaxed))
+        atomic_store_explicit(&hist->max, latency, memory_order_relaxed);
+
+    if (latency < LATENCY_HIST_SIZE) {
+        add(&hist->buckets[latency], 1);
+    } else {
+        unsigned long overflows = atomic_load_explicit(&hist->overflows, memory_order_relaxed);
+        if (overflows < LATENCY_OVERFLOW_CYCLES) hist->overflowCycles[overflows] = cycle;
+        atomic_store_explicit(&hist->overflows, overflows + 1, memory_order_release);
+    }
+}
+
+void dump_latency_histograms(FILE *out) {
+    int count = atomic_load(&latencyHistCount);
+    unsigned long cycles, overflows;
+
+    if (count > LATENCY_MAX_THREADS) count = LATENCY_MAX_THREADS;
+
+    fprintf(out, "# Priorities:");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, " %d", latencyHists[i].priority);
+    }
+    fprintf(out, "\n# Histogram\n");
+    for (int bucket = 0; bucket < LATENCY_HIST_SIZE; bucket++) {
+        fprintf(out, "%06d", bucket);
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "%s%06lu", i ? "\t" : " ", atomic_load(&latencyHists[i].buckets[bucket]));
+        }
+        fprintf(out, "\n");
+    }
+
+    // Total counts the samples inside the histogram like cyclictest does
+    fprintf(out, "# Total:");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, " %09lu", atomic_load(&latencyHists[i].cycles) - atomic_load(&latencyHists[i].overflows));
+    }
+    fprintf(out, "\n# Min Latencies:");
+    for (int i = 0; i < count; i++) {
+        cycles = atomic_load(&latencyHists[i].cycles);
+        fprintf(out, " %05llu", cycles ? (unsigned long long) atomic_load(&latencyHists[i].min) : 0);
+    }
+    fprintf(out, "\n# Avg Latencies:");
+    for (int i = 0; i < count; i++) {
+        cycles = atomic_load(&latencyHists[i].cycles);
+        fprintf(out, " %05llu", cycles ? (unsigned long long) atomic_load(&latencyHists[i].sum) / cycles : 0);
+    }
+    fprintf(out, "\n# Max Latencies:");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, " %05llu", (unsigned long long) atomic_load(&latencyHists[i].max));
+    }
+    fprintf(out, "\n# Histogram Overflows:");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, " %05lu", atomic_load(&latencyHists[i].overflows));
+    }
+    fprintf(out, "\n# Histogram Overflow at cycle number:\n");
+    for (int i = 0; i < count; i++) {
+        overflows = atomic_load_explicit(&latencyHists[i].overflows, memory_order_acquire);
+        if (overflows > LATENCY_OVERFLOW_CYCLES) overflows = LATENCY_OVERFLOW_CYCLES;
+
+        fprintf(out, "# Thread %d:", i);
+        for (unsigned long j = 0; j < overflows; j++) {
+            fprintf(out, " %lu", latencyHists[i].overflowCycles[j]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+uint64_t exec_budget(const exec_stats_t *stats) {
+    uint64_t max = atomic_load_explicit(&stats->max, memory_order_relaxed);
+    uint64_t budget = (max * (100 + EXEC_BUDGET_MARGIN) / 100 + 999) / 1000;
+
+    if (budget < DEADLINE_MIN_RUNTIME) budget = DEADLINE_MIN_RUNTIME;
+    if (stats->deadline && budget > stats->deadline) budget = stats->deadline;
+
+    return budget;
+}
+
+// Move the budget of the calling deadline thread to the suggestion, small changes are not worth a syscall
+static void tune_budget(exec_stats_t *stats) {
+    uint64_t runtime = atomic_load_explicit(&stats->runtime, memory_order_relaxed) / 1000;
+    uint64_t budget = exec_budget(stats);
+
+    if (budget <= runtime + runtime / 8 && budget + runtime / 8 >= runtime) return;
+
+    if (set_deadline(budget, stats->deadline, stats->period)) {
+        RTLOG("%s: budget of %llu us not admitted\n", stats->name, (unsigned long long) budget);
+        return;
+    }
+    atomic_store_explicit(&stats->runtime, budget * 1000, memory_order_relaxed);
+}
+
+static void exec_add(exec_stats_t *stats, uint64_t time) {
+    uint64_t bucket = time / 1000;
+    unsigned long samples = atomic_load_explicit(&stats->samples, memory_order_relaxed) + 1;
+
+    atomic_store_explicit(&stats->samples, samples, memory_order_relaxed);
+    add64(&stats->sum, time);
+    if (time < atomic_load_explicit(&stats->min, memory_order_relaxed))
+        atomic_store_explicit(&stats->min, time, memory_order_relaxed);
+    if (time > atomic_load_explicit(&stats->max, memory_order_relaxed))
+        atomic_store_explicit(&stats->max, time, memory_order_relaxed);
+
+    if (bucket < EXEC_HIST_SIZE) add(&stats->buckets[bucket], 1);
+    else add(&stats->overflows, 1);
+
+    if (stats->autoBudget && samples % EXEC_TUNE_SAMPLES == 0) tune_budget(stats);
+}
+
+void exec_time_record() {
+    exec_stats_t *stats = ownExec;
+    uint64_t cpu, job, time;
+
+    if (stats == NULL) return;
+
+    // the thread CPU clock stands still while the thread waits, so the time since the last job is this job
+    cpu = thread_cpu_time();
+    job = cpu - stats->lastCpu;
+    stats->lastCpu = cpu;
+
+    if (stats->period == 0) {
+        exec_add(stats, job);
+        return;
+    }
+
+    // a deadline budget is per period, so the jobs of a period are one sample. Periods without jobs are no sample.
+    time = get_clock_time();
+    if (time >= stats->windowStart + stats->period) {
+        if (stats->windowSum) exec_add(stats, stats->windowSum);
+        stats->windowStart = time;
+        stats->windowSum = 0;
+    }
+    stats->windowSum += job;
+}
+
+// Upper bound in us of the bucket which holds the given fraction of the samples, max if it is an overflow
+static uint64_t exec_percentile(const exec_stats_t *stats, double fraction) {
+    unsigned long samples = atomic_load(&stats->samples);
+    unsigned long sum = 0;
+
+    for (int i = 0; i < EXEC_HIST_SIZE; i++) {
+        sum += atomic_load_explicit(&stats->buckets[i], memory_order_relaxed);
+        if (sum >= samples * fraction) return i + 1;
+    }
+
+    return (atomic_load(&stats->max) + 999) / 1000;
+}
+
+void exec_report() {
+    int count = atomic_load(&latencyHistCount);
+    unsigned long samples;
+    const char *name;
+
+    if (count > LATENCY_MAX_THREADS) count = LATENCY_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        exec_stats_t *stats = &execStats[i];
+        if ((samples = atomic_load(&stats->samples)) == 0) continue;
+
+        // the log keeps the pointer, so only names of the plans or literals
+        name = stats->name != NULL ? stats->name : "unplanned thread";
+        RTLOG("%s: exec min/avg/p99/max %llu/%llu/%llu/%llu us\n", name,
+              (unsigned long long) atomic_load(&stats->min) / 1000,
+              (unsigned long long) atomic_load(&stats->sum) / samples / 1000,
+              (unsigned long long) exec_percentile(stats, 0.99),
+              (unsigned long long) (atomic_load(&stats->max) + 999) / 1000);
+        RTLOG("%s: %lu %s, budget %llu us, suggested %llu us\n", name, samples, stats->period ? "periods" : "jobs",
+              (unsigned long long) atomic_load(&stats->runtime) / 1000, (unsigned long long) exec_budget(stats));
+    }
+}
@@ -7,8 +7,15 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "rtlog.h"
 
 #define THREAD_STACK_SIZE (256*1024)
+// part of the stack which is touched before the thread function runs, the rest is left
+// for the frames of the start helper and the static TLS which glibc puts on the stack
+#define THREAD_STACK_PREFAULT (THREAD_STACK_SIZE - 32*1024)
 
 #define ERROR_PTH_ATTRS_FAILED 1
 #define ERROR_PTH_SETSTACKSIZE_FAILED 2
@@ -16,15 +23,34 @@
 #define ERROR_PTH_SETINHERITSCHED_FAILED 4
 #define ERROR_PTH_SETSCHEDPARAM_FAILED 5
 #define ERROR_PTH_THREADCREATE_FAILED 6
+#define ERROR_PTH_SETAFFINITY_FAILED 7
+#define ERROR_PTH_SETDEADLINE_FAILED 8
 
 #define nullptr ((void*)0)
 
+// wakeup latency histogram per RT thread, one bucket per us like cyclictest -h
+#define LATENCY_MAX_THREADS 16
+#define LATENCY_HIST_SIZE 400
+// cycle numbers of the first overflows which are kept per thread
+#define LATENCY_OVERFLOW_CYCLES 32
+
+// execution time histogram per RT thread, one bucket per us
+#define EXEC_HIST_SIZE 1000
+// an automatic SCHED_DEADLINE budget is checked every EXEC_TUNE_SAMPLES samples
+#define EXEC_TUNE_SAMPLES 16
+// suggested budget on top of the longest execution time in percent
+#define EXEC_BUDGET_MARGIN 25
+// the kernel refuses budgets below 1024 ns
+#define DEADLINE_MIN_RUNTIME 2
+// an automatic budget starts at this fraction of the deadline until there are samples
+#define DEADLINE_INITIAL_SHARE 4
+
 #define VERBOSE
 #define TIMER
 
 #ifdef VERBOSE
-#define PRINT_START(i) printf("Started #%d\n", i);
-#define PRINT_END(i) printf("Ended #%d\n", i);
+#define PRINT_START(i) RTLOG("Started #%d\n", i);
+#define PRINT_END(i) RTLOG("Ended #%d\n", i);
 #else
 #define PRINT_START(i) nullptr;
 #define PRINT_END(i) nullptr;
@@ -32,19 +58,126 @@
 
 typedef void (*callbk_t)();
 
+#define ACTIVATION_ACTIVE   1u
+#define ACTIVATION_WAITERS  2u
+// generation of kick_activation() in the bits above the flags
+#define ACTIVATION_KICK     4u
+
+// Activation of one or more waiting threads. The state is a futex word: activate() never
+// blocks and only makes a syscall if a thread sleeps on it, the waiters need no lock.
+typedef struct {
+    atomic_uint state; // ACTIVATION_ACTIVE | ACTIVATION_WAITERS, kick generation above
+    atomic_ullong signalTime; // time of the last activate() in us, intended wakeup of the waiter
+} activation_t;
+
+#define ACTIVATION_INITIALIZER {0, 0}
+
 typedef struct {
-    bool cond;
-    pthread_cond_t pthreadCond;
-    pthread_mutex_t pthreadMutex;
-} cond_wait_t;
+    int priority;
+    atomic_ulong buckets[LATENCY_HIST_SIZE];
+    atomic_ulong cycles; // all samples
+    atomic_ulong overflows;
+    atomic_ullong min, max, sum; // 64 bit also on 32 bit ARM
+    unsigned long overflowCycles[LATENCY_OVERFLOW_CYCLES];
+} latency_hist_t;
+
+// CPU time per job of one RT thread, or per period for threads with a period in their plan
+typedef struct {
+    const char *name;
+    atomic_ulong buckets[EXEC_HIST_SIZE];
+    atomic_ulong samples; // all samples
+    atomic_ulong overflows;
+    atomic_ullong min, max, sum; // in ns, 64 bit also on 32 bit ARM
+    atomic_ullong runtime; // SCHED_DEADLINE budget in ns, 0 for the other policies
+    uint64_t deadline, period; // in us, from the plan
+    bool autoBudget;
+    uint64_t lastCpu, windowStart, windowSum; // only used by the owning thread
+} exec_stats_t;
+
+// Placement of one thread, main.c keeps one entry per thread in a table
+typedef struct {
+    const char *name;
+    int cpu; // ignored for SCHED_DEADLINE, see start_planned_thread()
+    int policy; // SCHED_FIFO, SCHED_RR, SCHED_OTHER or SCHED_DEADLINE
+    int priority; // 0 for SCHED_OTHER and SCHED_DEADLINE
+    // SCHED_DEADLINE budget per period in us, 0 to derive it from the measured execution times.
+    // The period also groups the execution times of the other policies for exec_report().
+    uint64_t runtime, deadline, period;
+} thread_plan_t;
 
 typedef struct {
     callbk_t func;
     void *arg;
+    const thread_plan_t *plan; // set by start_planned_thread()
+    activation_t scheduled; // a SCHED_DEADLINE thread reports its admission with it
+    int schedError;
 } thread_t;
 
-// Start a given function as realtime thread on cpuset with priority
+// Start a given function as realtime thread on cpuset with priority. The thread is
+// created on cpuset, it never runs anywhere else.
 extern int start_realtime_thread(pthread_t *pthread, thread_t *func, cpu_set_t *cpuset, int priority);
+
+// Start a given function with core, policy and priority of plan. A SCHED_DEADLINE thread
+// applies its parameters itself before it runs and gets ERROR_PTH_SETDEADLINE_FAILED if the
+// kernel does not admit them. Its core is not set: the kernel only accepts deadline threads
+// which may run on all CPUs of their root domain, so the process has to run in an exclusive
+// cpuset to keep them on a core.
+extern int start_planned_thread(pthread_t *pthread, thread_t *func, const thread_plan_t *plan);
+
+// cpuset with the core of plan, for the functions which start their threads themselves
+extern cpu_set_t plan_cpuset(const thread_plan_t *plan);
+
+// Hold all threads started from now on by start_realtime_thread() or start_planned_thread()
+// at a startup barrier after they are placed and have prefaulted their stacks (rtmem.h)
+extern void hold_thread_startup();
+
+// Wait until all held threads reached the barrier and release them together
+extern void release_thread_startup();
 extern struct timespec diff(struct timespec start, struct timespec end);
 
+// Set activation and wake its waiters, stamping the intended wakeup time for latency_record().
+// Wait-free if nobody waits, otherwise one FUTEX_WAKE.
+extern void activate(activation_t *activation);
+
+// Clear activation, the waiters keep running until they check it again
+extern void deactivate(activation_t *activation);
+
+static inline bool is_activated(activation_t *activation) {
+    return atomic_load_explicit(&activation->state, memory_order_acquire) & ACTIVATION_ACTIVE;
+}
+
+// Sleep until activation is set, it stays set
+extern void wait_activation(activation_t *activation);
+
+// Sleep until activation is set or *stop is true, returns false in the latter case. The thread
+// which sets stop calls kick_activation() afterwards, so no waiter misses it.
+extern bool wait_activation_or_stop(activation_t *activation, atomic_bool *stop);
+
+// Wake all waiters of activation without setting it, so they check their stop flag
+extern void kick_activation(activation_t *activation);
+
+// Sleep until activation is set and clear it, for threads which run once per activation
+extern void take_activation(activation_t *activation);
+
+// Get current monotonic clock time in us, the time base of all timestamps of the library
+extern uint64_t get_clock_time();
+
+// Add the delay between the intended wakeup (monotonic us) and now to the histogram of
+// the calling thread. Does nothing in threads not started by start_realtime_thread().
+extern void latency_record(uint64_t intended);
+
+// Write the histograms of all RT threads in the format of cyclictest -h
+extern void dump_latency_histograms(FILE *out);
+
+// End a job of the calling thread: adds its thread CPU time since the last call to its
+// execution time stats. Threads with an automatic SCHED_DEADLINE budget adapt it here every
+// EXEC_TUNE_SAMPLES samples. Does nothing in threads not started by this library.
+extern void exec_time_record();
+
+// Budget in us which covers the longest execution time of stats with EXEC_BUDGET_MARGIN
+extern uint64_t exec_budget(const exec_stats_t *stats);
+
+// Log min, avg, p99 and max execution time, the current and the suggested budget of all RT threads
+extern void exec_report();
+
 #endif //GPIO_REALTIME_H
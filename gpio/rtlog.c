@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtlog.h"
+#include "realtime.h"
+#include "edge_ring.h"
+
+#define RTLOG_SPEC_LEN      16
+
+// Ring of one logging thread, see spsc_ring_t
+typedef struct {
+    spsc_ring_t ring;
+    unsigned int reportedDropped; // dropped records the drain thread already reported
+
+    _Alignas(CACHE_LINE_SIZE) rtlog_record_t records[RTLOG_RING_SIZE];
+} rtlog_ring_t;
+
+static rtlog_ring_t rings[RTLOG_MAX_THREADS];
+static atomic_uint ringCount;
+// records of threads which did not get a ring
+static atomic_uint unassignedDropped;
+static unsigned int unassignedReported;
+
+static _Thread_local rtlog_ring_t *ownRing;
+static _Thread_local bool noRing;
+
+static pthread_t drainPThread;
+
+// Claim a ring for the calling thread, NULL if all are taken
+static rtlog_ring_t *get_own_ring() {
+    unsigned int index;
+
+    if (ownRing != NULL || noRing) return ownRing;
+
+    index = atomic_fetch_add_explicit(&ringCount, 1, memory_order_acq_rel);
+    if (index >= RTLOG_MAX_THREADS) {
+        noRing = true;
+        return NULL;
+    }
+    ownRing = &rings[index];
+
+    return ownRing;
+}
+
+void rtlog_attach() {
+    get_own_ring();
+}
+
+void rtlog_write(const char *fmt, const rtlog_arg_t *args) {
+    rtlog_ring_t *ring = get_own_ring();
+    rtlog_record_t *record;
+    unsigned int slot;
+
+    if (ring == NULL) {
+        atomic_fetch_add_explicit(&unassignedDropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    if (!spsc_ring_reserve(&ring->ring, RTLOG_RING_SIZE, &slot)) return;
+
+    record = &ring->records[slot];
+    record->time = get_clock_time();
+    record->fmt = fmt;
+    memcpy(record->args, args, sizeof record->args);
+
+    spsc_ring_publish(&ring->ring);
+}
+
+// Consumer: oldest record of ring or NULL if it is empty
+static rtlog_record_t *peek(rtlog_ring_t *ring) {
+    unsigned int slot;
+
+    return spsc_ring_peek(&ring->ring, RTLOG_RING_SIZE, &slot) ? &ring->records[slot] : NULL;
+}
+
+// printf() the record with the argument types taken from the conversions of the format
+static void format_record(FILE *out, const rtlog_record_t *record) {
+    const char *c = record->fmt;
+    char spec[RTLOG_SPEC_LEN];
+    int argIndex = 0;
+    int len;
+
+    while (*c) {
+        if (*c != '%') {
+            fputc(*c++, out);
+            continue;
+        }
+        if (c[1] == '%') {
+            fputc('%', out);
+            c += 2;
+            continue;
+        }
+
+        // copy the conversion specification up to the conversion character
+        len = 0;
+        do {
+            spec[len++] = *c++;
+        } while (*c && !strchr("diouxXcfFeEgGaAsp", *c) && len < RTLOG_SPEC_LEN - 2);
+        if (*c) spec[len++] = *c++;
+        spec[len] = 0;
+
+        if (argIndex >= RTLOG_MAX_ARGS) {
+            fputs(spec, out);
+            continue;
+        }
+        const rtlog_arg_t *arg = &record->args[argIndex++];
+
+        switch (spec[len - 1]) {
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                fprintf(out, spec, arg->d);
+                break;
+            case 's':
+            case 'p':
+                fprintf(out, spec, arg->s);
+                break;
+            default:
+                // the length modifier of the format matches the argument type, which the compiler checked
+                if (strstr(spec, "ll")) fprintf(out, spec, arg->l);
+                else if (strchr(spec, 'l')) fprintf(out, spec, (long) arg->l);
+                else fprintf(out, spec, (int) arg->l);
+        }
+    }
+}
+
+// Report records which were dropped since the last call, true if anything was written
+static bool report_dropped(FILE *out, unsigned int count) {
+    unsigned int dropped;
+    bool written = false;
+
+    for (unsigned int i = 0; i < count; i++) {
+        dropped = spsc_ring_dropped(&rings[i].ring);
+        if (dropped != rings[i].reportedDropped) {
+            fprintf(out, "rtlog: %u records of thread %u dropped\n", dropped - rings[i].reportedDropped, i);
+            rings[i].reportedDropped = dropped;
+            written = true;
+        }
+    }
+
+    dropped = atomic_load_explicit(&unassignedDropped, memory_order_relaxed);
+    if (dropped != unassignedReported) {
+        fprintf(out, "rtlog: %u records of threads without buffer dropped\n", dropped - unassignedReported);
+        unassignedReported = dropped;
+        written = true;
+    }
+
+    return written;
+}
+
+// Merges the records of all rings by time and writes them to stdout
+_Noreturn static void *drain_thread(void *arg) {
+    rtlog_record_t *record, *oldest;
+    rtlog_ring_t *oldestRing;
+    unsigned int count;
+    bool written;
+
+    (void) arg;
+
+    while (1) {
+        count = atomic_load_explicit(&ringCount, memory_order_acquire);
+        if (count > RTLOG_MAX_THREADS) count = RTLOG_MAX_THREADS;
+        written = false;
+
+        while (1) {
+            oldest = NULL;
+            oldestRing = NULL;
+            for (unsigned int i = 0; i < count; i++) {
+                record = peek(&rings[i]);
+                if (record != NULL && (oldest == NULL || record->time < oldest->time)) {
+                    oldest = record;
+                    oldestRing = &rings[i];
+                }
+            }
+            if (oldest == NULL) break;
+
+            format_record(stdout, oldest);
+            spsc_ring_release(&oldestRing->ring);
+            written = true;
+        }
+
+        if (report_dropped(stdout, count)) written = true;
+
+        if (written) fflush(stdout);
+        else usleep(RTLOG_DRAIN_PERIOD);
+    }
+}
+
+int rtlog_start(cpu_set_t *cpuset) {
+    pthread_attr_t attr;
+    int err;
+
+    // created on the housekeeping CPUs instead of being migrated there
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpuset);
+    err = pthread_create(&drainPThread, &attr, drain_thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    return err ? -1 : 0;
+}
+
+unsigned int rtlog_dropped() {
+    unsigned int dropped = atomic_load_explicit(&unassignedDropped, memory_order_relaxed);
+
+    for (unsigned int i = 0; i < RTLOG_MAX_THREADS; i++) {
+        dropped += spsc_ring_dropped(&rings[i].ring);
+    }
+
+    return dropped;
+}
@@ -0,0 +1,78 @@
+#ifndef GPIO_RTLOG_H
+#define GPIO_RTLOG_H
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// max number of threads which can log, every thread gets its own buffer on the first call
+#define RTLOG_MAX_THREADS   16
+// records per thread buffer, must be a power of two
+#define RTLOG_RING_SIZE     256
+#define RTLOG_MAX_ARGS      6
+// sleep time of the drain thread in us when all buffers are empty
+#define RTLOG_DRAIN_PERIOD  10000
+
+typedef union {
+    long long l; // all integers, 64 bit wide also on 32 bit ARM
+    double d;
+    const char *s;
+} rtlog_arg_t;
+
+// One log record: the format string is formatted by the drain thread, so it and all %s
+// arguments must stay valid (string literals)
+typedef struct {
+    uint64_t time; // monotonic time in us
+    const char *fmt;
+    rtlog_arg_t args[RTLOG_MAX_ARGS];
+} rtlog_record_t;
+
+static inline rtlog_arg_t rtlog_long(long l) { return (rtlog_arg_t) {.l = l}; }
+
+static inline rtlog_arg_t rtlog_llong(long long l) { return (rtlog_arg_t) {.l = l}; }
+
+static inline rtlog_arg_t rtlog_double(double d) { return (rtlog_arg_t) {.d = d}; }
+
+static inline rtlog_arg_t rtlog_str(const char *s) { return (rtlog_arg_t) {.s = s}; }
+
+#define RTLOG_ARG(x) _Generic((x), float: rtlog_double, double: rtlog_double, \
+        char *: rtlog_str, const char *: rtlog_str, long long: rtlog_llong, \
+        unsigned long long: rtlog_llong, default: rtlog_long)(x)
+
+#define RTLOG_MAP_0()
+#define RTLOG_MAP_1(a) RTLOG_ARG(a),
+#define RTLOG_MAP_2(a, b) RTLOG_ARG(a), RTLOG_ARG(b),
+#define RTLOG_MAP_3(a, b, c) RTLOG_ARG(a), RTLOG_ARG(b), RTLOG_ARG(c),
+#define RTLOG_MAP_4(a, b, c, d) RTLOG_MAP_3(a, b, c) RTLOG_ARG(d),
+#define RTLOG_MAP_5(a, b, c, d, e) RTLOG_MAP_4(a, b, c, d) RTLOG_ARG(e),
+#define RTLOG_MAP_6(a, b, c, d, e, f) RTLOG_MAP_5(a, b, c, d, e) RTLOG_ARG(f),
+#define RTLOG_NARGS_(_, a, b, c, d, e, f, n, ...) n
+#define RTLOG_NARGS(...) RTLOG_NARGS_(_, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define RTLOG_CAT_(a, b) a ## b
+#define RTLOG_CAT(a, b) RTLOG_CAT_(a, b)
+
+// Log a printf style message with up to RTLOG_MAX_ARGS arguments without blocking.
+// The dead printf() only lets the compiler check the format.
+#define RTLOG(fmt, ...) do { \
+        if (0) printf(fmt, ##__VA_ARGS__); \
+        rtlog_write(fmt, (rtlog_arg_t[RTLOG_MAX_ARGS + 1]) { \
+                RTLOG_CAT(RTLOG_MAP_, RTLOG_NARGS(__VA_ARGS__))(__VA_ARGS__) {0}}); \
+    } while (0)
+
+// Copy a record into the buffer of the calling thread. Never blocks, counts the
+// record as dropped if the buffer is full or no buffer is left.
+extern void rtlog_write(const char *fmt, const rtlog_arg_t *args);
+
+// Claim the buffer of the calling thread now instead of on its first record
+extern void rtlog_attach();
+
+// Start the drain thread with normal priority on cpuset. It formats the records of
+// all threads in time order and writes them to stdout.
+extern int rtlog_start(cpu_set_t *cpuset);
+
+// Number of records dropped so far
+extern unsigned int rtlog_dropped();
+
+#endif //GPIO_RTLOG_H
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "realtime.h"
+#include "rtmem.h"
+
+static atomic_ulong faults;
+static _Thread_local bool faultBaseline;
+static _Thread_local long minorFaults, majorFaults;
+
+int rtmem_init(size_t heap) {
+    char *prefault;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        printf("mlockall failed: %m\n");
+        return -1;
+    }
+
+    // freed memory stays in the heap and every allocation comes from it, so nothing is unmapped
+    // and faulted in again later. One arena, new threads would otherwise map their own.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    if ((prefault = malloc(heap)) == nullptr) return -1;
+    memset(prefault, 0, heap);
+    free(prefault);
+
+    return 0;
+}
+
+void rtmem_prefault_stack() {
+    volatile char stack[THREAD_STACK_PREFAULT];
+
+    for (size_t i = 0; i < sizeof stack; i += 4096) stack[i] = 0;
+}
+
+void rtmem_thread_ready() {
+    struct timespec ts;
+    struct rusage usage;
+
+    // the first write to the TLS of the thread and the first read of the vDSO data page (which
+    // mlockall() doesn't populate) may fault, so both must not happen after sampling
+    faultBaseline = true;
+    minorFaults = majorFaults = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    getrusage(RUSAGE_THREAD, &usage);
+    minorFaults = usage.ru_minflt;
+    majorFaults = usage.ru_majflt;
+}
+
+void rtmem_check_faults(const char *where) {
+    struct rusage usage;
+    long minor, major;
+
+    if (!faultBaseline) return;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    minor = usage.ru_minflt - minorFaults;
+    major = usage.ru_majflt - majorFaults;
+    if (minor == 0 && major == 0) return;
+
+    minorFaults = usage.ru_minflt;
+    majorFaults = usage.ru_majflt;
+    atomic_fetch_add(&faults, minor + major);
+    RTLOG("%s: %ld minor and %ld major page faults in RT thread\n", where, minor, major);
+}
+
+unsigned long rtmem_faults() {
+    return atomic_load(&faults);
+}
@@ -0,0 +1,38 @@
+#ifndef GPIO_RTMEM_H
+#define GPIO_RTMEM_H
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// heap which is faulted in and kept by malloc, covers stdio buffers and late allocations
+#define RTMEM_HEAP_PREFAULT (1024*1024)
+
+// Page fault checking mode, enabled with the CMake option GPIO_CHECK_FAULTS. RT threads call
+// RTMEM_CHECK() once per cycle and every page fault since their start is logged.
+#ifdef RTMEM_CHECK_FAULTS
+#define RTMEM_CHECK() rtmem_check_faults(__func__)
+#else
+#define RTMEM_CHECK()
+#endif
+
+// Lock all current and future pages, stop malloc from returning memory to the OS or using
+// mmap and prefault heap bytes of the heap. Later allocations come from the locked heap, so
+// they don't fault once it has grown. Call it first in main, before anything is mapped or allocated.
+extern int rtmem_init(size_t heap);
+
+// Touch the stack of the calling thread below the caller, so its first cycles don't page fault
+extern void rtmem_prefault_stack();
+
+// Take the fault counters of the calling thread as baseline, all later faults are reported
+extern void rtmem_thread_ready();
+
+// Log the page faults of the calling thread since the last call. Does nothing in threads
+// which didn't call rtmem_thread_ready().
+extern void rtmem_check_faults(const char *where);
+
+// Page faults of all RT threads after rtmem_thread_ready() found by rtmem_check_faults()
+extern unsigned long rtmem_faults();
+
+#endif //GPIO_RTMEM_H
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "series.h"
+#include "stats.h"
+#include "ui.h"
+
+// length and bucket resolution of the tiers in ms
+static const struct {
+    uint32_t capacity;
+    int64_t resolution;
+} tierLayout[SERIES_TIERS] = {
+        [SERIES_RAW] = {SERIES_RAW_LEN, 0},
+        [SERIES_MINUTE] = {SERIES_MINUTE_LEN, 60 * 1000},
+        [SERIES_HOUR] = {SERIES_HOUR_LEN, 60 * 60 * 1000},
+};
+
+static size_t series_size() {
+    size_t points = 0;
+
+    for (int i = 0; i < SERIES_TIERS; i++) points += tierLayout[i].capacity;
+
+    return sizeof(struct series_header) + points * sizeof(struct series_point);
+}
+
+static bool has_layout(const struct series_header *header) {
+    if (header->magic != SERIES_MAGIC || header->version != SERIES_VERSION
+        || header->pointSize != sizeof(struct series_point) || header->tierCount != SERIES_TIERS)
+        return false;
+
+    for (int i = 0; i < SERIES_TIERS; i++) {
+        if (header->tiers[i].capacity != tierLayout[i].capacity
+            || header->tiers[i].resolution != tierLayout[i].resolution)
+            return false;
+    }
+
+    return true;
+}
+
+int open_series(series_t *series, const char *file) {
+    struct series_header *header;
+    struct series_point *points;
+    uint32_t first = 0;
+    char path[255];
+
+    ui_file_path(path, sizeof(path), file);
+
+    if ((header = map_ring_file(path, series_size())) == NULL) {
+        series->header = NULL;
+        return -1;
+    }
+
+    series->header = header;
+    points = (struct series_point *) (header + 1);
+
+    if (!has_layout(header)) {
+        memset(header, 0, series_size());
+        header->version = SERIES_VERSION;
+        header->pointSize = sizeof(struct series_point);
+        header->tierCount = SERIES_TIERS;
+        for (int i = 0; i < SERIES_TIERS; i++) {
+            header->tiers[i].capacity = tierLayout[i].capacity;
+            header->tiers[i].resolution = tierLayout[i].resolution;
+            header->tiers[i].first = first;
+            first += tierLayout[i].capacity;
+        }
+        header->magic = SERIES_MAGIC;
+    }
+
+    for (int i = 0; i < SERIES_TIERS; i++) {
+        series->tiers[i] = (mmap_ring_t) {&header->tiers[i].sequence, points + header->tiers[i].first,
+                                          sizeof(struct series_point), header->tiers[i].capacity};
+    }
+
+    return 0;
+}
+
+void close_series(series_t *series) {
+    if (series->header == NULL) return;
+
+    munmap(series->header, series_size());
+    series->header = NULL;
+}
+
+// Add value to the open bucket of tier, a sample of a new bucket closes it first
+static void roll_up(series_t *series, int index, int64_t time, double value) {
+    struct series_tier *tier = &series->header->tiers[index];
+    struct series_point *open = &tier->open;
+    int64_t bucket = time - time % tier->resolution;
+
+    if (open->count != 0 && open->time != bucket) mmap_ring_push(&series->tiers[index], open);
+
+    stats_write_begin(&tier->openSeq);
+    if (open->count == 0 || open->time != bucket) {
+        *open = (struct series_point) {bucket, value, value, value, 1, 0};
+    } else {
+        if (value < open->min) open->min = value;
+        if (value > open->max) open->max = value;
+        open->sum += value;
+        open->count++;
+    }
+    stats_write_end(&tier->openSeq);
+}
+
+void series_append_at(series_t *series, int64_t time, double value) {
+    struct series_header *header = series->header;
+    struct series_point point;
+
+    if (header == NULL) return;
+
+    // a clock step back must not break the order of the rings
+    if (time < header->last) time = header->last;
+    header->last = time;
+
+    point = (struct series_point) {time, value, value, value, 1, 0};
+    mmap_ring_push(&series->tiers[SERIES_RAW], &point);
+
+    for (int i = SERIES_RAW + 1; i < SERIES_TIERS; i++) roll_up(series, i, time, value);
+}
+
+void series_append(series_t *series, double value) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    series_append_at(series, (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000, value);
+}
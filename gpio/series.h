@@ -0,0 +1,77 @@
+#ifndef GPIO_SERIES_H
+#define GPIO_SERIES_H
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "mmap_ring.h"
+
+#define SERIES_MAGIC        0x53525354 // "TSRS"
+#define SERIES_VERSION      1
+
+// Tiers of a series, every sample goes into all of them. The raw tier keeps the samples, the
+// others one rollup per minute or hour. Each tier is a ring of fixed size, so a series file
+// never grows: with one sample per 2 minutes raw covers 5 days, minute 2 weeks and hour 1 year.
+enum {
+    SERIES_RAW, SERIES_MINUTE, SERIES_HOUR, SERIES_TIERS
+};
+
+#define SERIES_RAW_LEN      4096
+#define SERIES_MINUTE_LEN   (7 * 24 * 60)
+#define SERIES_HOUR_LEN     (366 * 24)
+
+// One sample (raw tier) or the rollup of one bucket, times in unix ms
+struct series_point {
+    int64_t time; // sample time or start of the bucket
+    double min;
+    double max;
+    double sum; // avg = sum / count
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// Ring of one tier, the points are sorted by time
+struct series_tier {
+    int64_t resolution; // bucket length in ms, 0 for raw
+    uint32_t capacity;
+    uint32_t first; // index of the first point of this tier in the file
+    atomic_uint openSeq; // seqlock of open, see stats.h
+    uint32_t reserved;
+    atomic_ullong sequence; // number of points written in total, the points are an mmap_ring_t
+    struct series_point open; // bucket which is still filled, not in the ring yet
+};
+
+// Header of the memory mapped series file, the points of all tiers follow directly after it
+struct series_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t pointSize;
+    uint32_t tierCount;
+    uint32_t reserved;
+    int64_t last; // time of the last sample, later samples never go back in time
+    struct series_tier tiers[SERIES_TIERS];
+};
+
+// Mapping of one series file, one writer and any number of readers (the UI, ui/history.py)
+typedef struct {
+    struct series_header *header;
+    mmap_ring_t tiers[SERIES_TIERS];
+} series_t;
+
+// Map the series file in the ui dir (see set_ui_dir()), creating it if necessary. A file of
+// another layout is started new.
+extern int open_series(series_t *series, const char *file);
+
+extern void close_series(series_t *series);
+
+// Add a sample with the current time to all tiers in O(1). Only touches the mapped pages,
+// so it may be called from RT threads after the file was mapped.
+extern void series_append(series_t *series, double value);
+
+// Same as series_append() with the sample time in unix ms
+extern void series_append_at(series_t *series, int64_t time, double value);
+
+#endif //GPIO_SERIES_H
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+gpio_stats_t *gpioStats;
+
+int stats_create(const char *file) {
+    gpio_stats_t *stats;
+    int fd;
+
+    // a stale segment of an older layout is replaced instead of being reused
+    unlink(file);
+    if ((fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+        perror("open");
+        return -1;
+    }
+
+    // zero filled, which is the initial state of all counters
+    if (ftruncate(fd, sizeof(gpio_stats_t)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    stats = mmap(NULL, sizeof(gpio_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    stats->version = STATS_VERSION;
+    stats->size = sizeof(gpio_stats_t);
+    stats->pid = getpid();
+    stats->startTime = time(NULL);
+    // readers check the magic last, so they never see a half initialized header
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+
+    gpioStats = stats;
+
+    return 0;
+}
+
+const gpio_stats_t *stats_map(const char *file) {
+    const gpio_stats_t *stats;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        perror("open");
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(gpio_stats_t)) {
+        fprintf(stderr, "%s: too small for version %d\n", file, STATS_VERSION);
+        close(fd);
+        return NULL;
+    }
+
+    stats = mmap(NULL, sizeof(gpio_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION || stats->size != sizeof(gpio_stats_t)) {
+        fprintf(stderr, "%s: version %u, expected %d\n", file, stats->version, STATS_VERSION);
+        munmap((void *) stats, sizeof(gpio_stats_t));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    return stats;
+}
+
+void stats_read(const atomic_uint *seq, void *dst, const void *src, size_t size) {
+    unsigned int begin, end;
+
+    do {
+        while ((begin = atomic_load_explicit(seq, memory_order_acquire)) & 1);
+        memcpy(dst, src, size);
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(seq, memory_order_relaxed);
+    } while (begin != end);
+}
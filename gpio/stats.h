@@ -0,0 +1,125 @@
+#ifndef GPIO_STATS_H
+#define GPIO_STATS_H
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "gpio.h"
+
+// Live statistics in a shared memory file, read by gpiostat while the controller runs.
+// RT threads only do atomic adds and seqlock writes on the segment, never a syscall.
+#define STATS_FILE          "/dev/shm/gpio-stats"
+#define STATS_MAGIC         0x54535047 // "GPST"
+// increment on every layout change, gpiostat refuses segments of other versions
+#define STATS_VERSION       1
+
+#define STATS_PINS          GPIO_COUNT
+#define STATS_TASKS         8
+#define STATS_ZONES         32
+#define STATS_NAME_LEN      16
+// log2 histogram in us, bucket 0 counts 0 us, bucket i values from 2^(i-1) to 2^i - 1 us,
+// the last bucket everything above
+#define STATS_HIST_SIZE     24
+
+// Counters of one pin, may be incremented by several threads
+typedef struct {
+    atomic_ullong edges; // edges handed to the callback
+    atomic_ullong timeouts; // GPIO_TIMEOUT calls
+    atomic_ullong errors; // failed poll() or read() of the ISR
+    atomic_ullong measurements; // frequency measurements
+    atomic_ullong lastFreq; // in mHz, result of the last measurement
+    atomic_ullong latency[STATS_HIST_SIZE]; // from edge time to callback
+} stats_pin_t;
+
+// Snapshot of one task of the cyclic executive, written by the executive under seq
+typedef struct {
+    atomic_uint seq;
+    char name[STATS_NAME_LEN];
+    uint64_t releases;
+    uint64_t overruns;
+    uint64_t deadlineMisses;
+    uint64_t maxResponse; // in us
+    atomic_ullong response[STATS_HIST_SIZE]; // from release to done, outside of seq
+} stats_task_t;
+
+// Last measurement of one zone, written by the measuring thread under seq
+typedef struct {
+    atomic_uint seq;
+    uint64_t measurements;
+    int64_t freq; // in mHz
+    int64_t filtered; // in mHz
+    bool dry;
+} stats_measurement_t;
+
+// Dosing of one zone, written by the pump scheduler under seq when a run settled
+typedef struct {
+    atomic_uint seq;
+    uint64_t runs;
+    uint64_t cutoffs; // runs stopped by the flow ISR, the others hit the deadline
+    uint64_t pumpTime; // in us, sum of all runs
+    int64_t lastEdges; // flow edges of the last run including the overshoot
+    int64_t overshoot;
+    int64_t earlyStop;
+} stats_dose_t;
+
+typedef struct {
+    char name[STATS_NAME_LEN];
+    stats_measurement_t measurement;
+    stats_dose_t dose;
+} stats_zone_t;
+
+typedef struct {
+    // never changes after stats_create()
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // sizeof(gpio_stats_t)
+    int32_t pid;
+    int64_t startTime; // unix time in s
+
+    atomic_uint taskCount;
+    atomic_uint zoneCount;
+
+    stats_pin_t pins[STATS_PINS];
+    stats_task_t tasks[STATS_TASKS];
+    stats_zone_t zones[STATS_ZONES];
+} gpio_stats_t;
+
+// Segment of this process, nullptr until stats_create() succeeded and the writers skip their updates
+extern gpio_stats_t *gpioStats;
+
+// Create (or reset) the segment in file and publish it in gpioStats. Call it before the RT
+// threads start, returns -1 on errors.
+extern int stats_create(const char *file);
+
+// Map the segment of a running process read-only, nullptr if it doesn't exist or has another layout
+extern const gpio_stats_t *stats_map(const char *file);
+
+// Copy size bytes of a record protected by seq, retries while the writer is inside
+extern void stats_read(const atomic_uint *seq, void *dst, const void *src, size_t size);
+
+static inline void stats_add(atomic_ullong *counter, unsigned long long n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline void stats_hist(atomic_ullong *hist, uint64_t value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+    if (bucket >= STATS_HIST_SIZE) bucket = STATS_HIST_SIZE - 1;
+    atomic_fetch_add_explicit(&hist[bucket], 1, memory_order_relaxed);
+}
+
+// Seqlock of a record with one writer: the seq is odd while the record is changed
+static inline void stats_write_begin(atomic_uint *seq) {
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void stats_write_end(atomic_uint *seq) {
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+#endif //GPIO_STATS_H
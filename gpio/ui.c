@@ -2,9 +2,19 @@
 // Created by Fabi on 02.07.2020.
 //
 
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
 #include "ui.h"
+#include "rtlog.h"
 
-#define FREQ_MAX_LEN 20
 #define HISTORY_LEN 900
 
 char *file_dir;
@@ -13,9 +23,13 @@ void set_ui_dir(char *dir) {
     file_dir = dir;
 }
 
+void ui_file_path(char *path, size_t size, const char *file) {
+    snprintf(path, size, "%s%s", file_dir, file);
+}
+
 static FILE *open_file(const char *file, const char *mode) {
     char path[255];
-    snprintf(path, sizeof(path), "%s%s", file_dir, file);
+    ui_file_path(path, sizeof(path), file);
 
     return fopen(path, mode);
 }
@@ -24,75 +38,208 @@ static void close_file(FILE *fp) {
     fclose(fp);
 }
 
-void load_config(struct config_data *config) {
+// Read the next value of a calibration file, false if it is missing or no number
+static bool read_value(FILE *fp, long int *value) {
     char buf[255];
-    char *ptr;
+    char *end;
 
-    FILE *fp = open_file("calibration.csv", "r");
+    if (fscanf(fp, "%254s", buf) != 1) return false;
+    *value = strtol(buf, &end, 10);
 
-    // skip the header
-    fscanf(fp, "%s", buf);
+    return end != buf && *end == 0;
+}
 
-    // read arid value
-    fscanf(fp, "%s", buf);
-    config->arid = strtol(buf, &ptr, 10);
+int load_config(const char *file, struct config_data *config) {
+    char buf[255];
+    bool ok;
 
-    // read humid value
-    fscanf(fp, "%s", buf);
-    config->humid = strtol(buf, &ptr, 10);
+    FILE *fp = open_file(file, "r");
+    if (fp == NULL) return -1;
 
-    // read millilitres
-    fscanf(fp, "%s", buf);
-    config->milliliters = strtol(buf, &ptr, 10);
+    // skip the header, then read arid, humid and millilitres
+    ok = fscanf(fp, "%254s", buf) == 1
+         && read_value(fp, &config->arid)
+         && read_value(fp, &config->humid)
+         && read_value(fp, &config->milliliters);
 
     close_file(fp);
+
+    // a half written file or nonsense values must not reach the RT threads
+    if (!ok || config->arid <= config->humid || config->humid <= 0 || config->milliliters <= 0) return -1;
+
+    return 0;
 }
 
-void send_freq_to_ui(double freq) {
-    // + 1 because we need one free space for new value if history is already full
-    char oldFreqValues[HISTORY_LEN + 1][FREQ_MAX_LEN];
-    memset(oldFreqValues, 0, sizeof(oldFreqValues));
-    int lineCount = 0;
-    FILE *fp = 0;
+static const char *configFiles[MAX_CONFIGS];
+static int configCount;
 
-    fp = open_file("test-hydro.csv", "r");
-    // skip header
-    fgets(oldFreqValues[lineCount], FREQ_MAX_LEN, fp);
+// Published snapshots are never written again until CONFIG_SNAPSHOTS - 1 newer ones were published
+static struct config_data configSnapshots[MAX_CONFIGS][CONFIG_SNAPSHOTS];
+static unsigned int nextSnapshot[MAX_CONFIGS];
+static _Atomic(const struct config_data *) currentConfig[MAX_CONFIGS];
 
-    // read lines
-    for (lineCount = 0; lineCount < HISTORY_LEN; lineCount++) {
-        if (fgets(oldFreqValues[lineCount], FREQ_MAX_LEN, fp) == 0) {
-            // got last line before buffer end
-            break;
-        }
+const struct config_data *get_config(int index) {
+    return atomic_load_explicit(&currentConfig[index], memory_order_acquire);
+}
+
+// Publish config of file index if it differs from the current snapshot, true if it was published
+static bool publish_config(int index, const struct config_data *config) {
+    const struct config_data *current = get_config(index);
+    struct config_data *snapshot;
+
+    if (current != NULL && memcmp(current, config, sizeof *config) == 0) return false;
+
+    snapshot = &configSnapshots[index][nextSnapshot[index]];
+    nextSnapshot[index] = (nextSnapshot[index] + 1) % CONFIG_SNAPSHOTS;
+
+    *snapshot = *config;
+    atomic_store_explicit(&currentConfig[index], snapshot, memory_order_release);
+
+    return true;
+}
+
+// Load and publish config file index
+static void reload_config(int index) {
+    struct config_data config;
+
+    if (load_config(configFiles[index], &config) == -1) {
+        RTLOG("Ignoring invalid %s\n", configFiles[index]);
+    } else if (publish_config(index, &config)) {
+        RTLOG("%s: %ld - %ld - %ld\n", configFiles[index], config.arid, config.humid, config.milliliters);
     }
-    close_file(fp);
+}
+
+// Waits for the config files to be written or replaced and publishes the new values
+_Noreturn static void *config_watcher(void *arg) {
+    int fd = *(int *) arg;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed[MAX_CONFIGS];
+    ssize_t len;
+
+    while (1) {
+        len = read(fd, buf, sizeof buf);
+        if (len <= 0) {
+            RTLOG("config watcher read error\n");
+            sleep(1);
+            continue;
+        }
 
-    if (lineCount < HISTORY_LEN) {
-        // just append new data because we have space in history
-        fp = open_file("test-hydro.csv", "a");
+        // a burst of events for the same file is parsed only once
+        memset(changed, 0, sizeof changed);
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) ptr;
+            for (int i = 0; event->len && i < configCount; i++) {
+                if (strcmp(event->name, configFiles[i]) == 0) changed[i] = true;
+            }
+        }
 
-        if (lineCount == 1) {
-            // special case: empty file -> add header
-            fprintf(fp, "Frequenz in Hz\n");
+        for (int i = 0; i < configCount; i++) {
+            if (changed[i]) reload_config(i);
         }
+    }
+}
 
-        fprintf(fp, "%.0f\n", freq);
-        close_file(fp);
-    } else {
-        // remove oldest history element and append new one
-        char buf[FREQ_MAX_LEN];
-        snprintf(buf, FREQ_MAX_LEN, "%.0f\n", freq);
-        strncpy(oldFreqValues[HISTORY_LEN], buf, FREQ_MAX_LEN);
-
-        fp = open_file("test-hydro.csv", "w");
-        // write header
-        fprintf(fp, "Frequenz in Hz\n");
-        // i = 1 because we skip oldest element
-        for (int i = 1; i < HISTORY_LEN + 1; i++) {
-            fprintf(fp, "%s", oldFreqValues[i]);
+int watch_config(const char **files, int count, cpu_set_t *cpuset) {
+    static int fd;
+    struct config_data config;
+    pthread_attr_t attr;
+    pthread_t pthread;
+    int err;
+
+    if (count > MAX_CONFIGS) return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (load_config(files[i], &config) == -1) {
+            printf("Failed to load %s\n", files[i]);
+            return -1;
         }
-        close_file(fp);
+        configFiles[i] = files[i];
+        publish_config(i, &config);
+    }
+    configCount = count;
+
+    if ((fd = inotify_init1(IN_CLOEXEC)) < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    // watch the directory because editors (and the UI) may replace the file instead of writing it
+    if (inotify_add_watch(fd, file_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        close(fd);
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpuset);
+    err = pthread_create(&pthread, &attr, config_watcher, &fd);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static size_t freq_log_size() {
+    return sizeof(struct freq_log_header) + HISTORY_LEN * sizeof(struct freq_log_record);
+}
+
+int open_freq_log(freq_log_t *log, const char *file) {
+    struct freq_log_header *header;
+    char path[255];
+
+    ui_file_path(path, sizeof(path), file);
+
+    if ((header = map_ring_file(path, freq_log_size())) == NULL) {
+        log->header = NULL;
+        return -1;
+    }
+
+    log->header = header;
+    log->ring = (mmap_ring_t) {&header->sequence, header + 1, sizeof(struct freq_log_record), HISTORY_LEN};
+
+    // start a new log if the file is new or has a different layout
+    if (header->magic != FREQ_LOG_MAGIC || header->version != FREQ_LOG_VERSION
+        || header->recordSize != sizeof(struct freq_log_record) || header->capacity != HISTORY_LEN) {
+        memset(header, 0, freq_log_size());
+        header->version = FREQ_LOG_VERSION;
+        header->recordSize = sizeof(struct freq_log_record);
+        header->capacity = HISTORY_LEN;
+        header->magic = FREQ_LOG_MAGIC;
     }
 
+    return 0;
+}
+
+void close_freq_log(freq_log_t *log) {
+    if (log->header == NULL) return;
+
+    munmap(log->header, freq_log_size());
+    log->header = NULL;
+}
+
+// Append one record in O(1). Only touches the mapped pages, the kernel writes them back.
+void send_freq_to_ui(freq_log_t *log, double freq) {
+    struct freq_log_record record;
+    struct timespec ts;
+
+    if (log->header == NULL) return;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record = (struct freq_log_record) {(int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000, freq};
+
+    mmap_ring_push(&log->ring, &record);
+    atomic_store_explicit(&log->header->writeIndex,
+                          atomic_load_explicit(&log->header->sequence, memory_order_relaxed) % HISTORY_LEN,
+                          memory_order_relaxed);
+}
+
+int read_freq_log(freq_log_t *log, uint64_t *since, struct freq_log_record *records, int max) {
+    if (log->header == NULL) return 0;
+
+    return mmap_ring_read(&log->ring, since, records, max);
 }
@@ -5,9 +5,24 @@
 #ifndef GPIO_UI_H
 #define GPIO_UI_H
 
+#define _GNU_SOURCE
+
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "mmap_ring.h"
+
+// max number of config files, e.g. one per zone
+#define MAX_CONFIGS         32
+// config snapshots in rotation, a reader may hold one while this many - 1 newer ones are published
+#define CONFIG_SNAPSHOTS    8
+
+#define FREQ_LOG_MAGIC      0x52514648 // "HFQR"
+#define FREQ_LOG_VERSION    1
 
 struct config_data {
     long int arid;
@@ -15,13 +30,53 @@ struct config_data {
     long int milliliters;
 };
 
-// Sets the directory where calibration.csv and test_hydro.csv can be found. Files must already exist! Don't forget to set trailing slash!
+// Header of the memory mapped frequency log. The records follow directly after it.
+struct freq_log_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t capacity; // number of records
+    atomic_uint writeIndex; // sequence % capacity, kept for readers of older versions
+    atomic_ullong sequence; // number of records written in total, record n is in slot n % capacity
+};
+
+struct freq_log_record {
+    int64_t time; // unix time in ms
+    double freq; // in Hz
+};
+
+// Mapping of one frequency log file, the records are an mmap_ring_t
+typedef struct {
+    struct freq_log_header *header;
+    mmap_ring_t ring;
+} freq_log_t;
+
+// Sets the directory where the calibration and frequency log files can be found. Calibration files must already exist! Don't forget to set trailing slash!
 extern void set_ui_dir(char *dir);
 
-// Loads the content of calibration.csv into *config
-extern void load_config(struct config_data *config);
+// Path of file in the ui dir
+extern void ui_file_path(char *path, size_t size, const char *file);
+
+// Loads the content of a calibration file into *config. Returns -1 if the file can't be read or the values are invalid.
+extern int load_config(const char *file, struct config_data *config);
+
+// Publish the current content of count calibration files and start a thread on cpuset which
+// publishes a file again whenever it changes
+extern int watch_config(const char **files, int count, cpu_set_t *cpuset);
+
+// Current config snapshot of files[index], wait-free. The snapshot is never modified, use it only for a short time.
+extern const struct config_data *get_config(int index);
+
+// Map the frequency log file in the ui dir, creating it if necessary. Must be called before send_freq_to_ui().
+extern int open_freq_log(freq_log_t *log, const char *file);
+
+// Unmap the frequency log
+extern void close_freq_log(freq_log_t *log);
+
+// Save freq into log with rotation, oldest records are overwritten
+extern void send_freq_to_ui(freq_log_t *log, double freq);
 
-// Save freq into log with rotation
-extern void send_freq_to_ui(double freq);
+// Copy up to max records written after sequence *since (oldest first) and advance *since. Returns the number of records.
+extern int read_freq_log(freq_log_t *log, uint64_t *since, struct freq_log_record *records, int max);
 
 #endif //GPIO_UI_H
@@ -0,0 +1,259 @@
+import os
+import struct
+import tempfile
+import threading
+
+import numpy as np
+import pandas as pd
+
+# layout of the ring log written by gpio/ui.c (struct freq_log_header and struct freq_log_record)
+FREQ_LOG_HEADER = struct.Struct("<IHHIIQ")
+FREQ_LOG_MAGIC = 0x52514648
+FREQ_LOG_VERSION = 1
+FREQ_LOG_RECORD = np.dtype([("time", "<i8"), ("freq", "<f8")])
+
+# layout of the long-term series written by gpio/series.c (struct series_header, series_tier and series_point)
+SERIES_HEADER = struct.Struct("<IHHIIq")
+SERIES_TIER = struct.Struct("<qIIIIQqdddII")
+SERIES_MAGIC = 0x53525354
+SERIES_VERSION = 1
+SERIES_POINT = np.dtype([("time", "<i8"), ("min", "<f8"), ("max", "<f8"), ("sum", "<f8"),
+                         ("count", "<u4"), ("reserved", "<u4")])
+
+# samples kept in memory per file, older ones are dropped
+HISTORY_LIMIT = 2 * 1000 * 1000
+
+
+def lttb(x, y, threshold):
+    """Largest-Triangle-Three-Buckets: indices of threshold points of (x, y) which keep the shape of the line."""
+    n = len(y)
+    if threshold >= n or threshold < 3:
+        return np.arange(n)
+
+    # first and last point are kept, the others are split into threshold - 2 buckets
+    edges = np.linspace(1, n - 1, threshold - 1).astype(np.int64)
+    selected = np.empty(threshold, dtype=np.int64)
+    selected[0] = 0
+    selected[-1] = n - 1
+    a = 0
+
+    for i in range(threshold - 2):
+        start, end = edges[i], edges[i + 1]
+        # average of the next bucket, the last point for the last bucket
+        if i + 2 < len(edges):
+            next_x = x[end:edges[i + 2]].mean()
+            next_y = y[end:edges[i + 2]].mean()
+        else:
+            next_x, next_y = x[n - 1], y[n - 1]
+
+        # point of this bucket with the largest triangle between the last selected point and the next average
+        area = np.abs((x[a] - next_x) * (y[start:end] - y[a]) - (x[a] - x[start:end]) * (next_y - y[a]))
+        a = start + int(np.argmax(area))
+        selected[i + 1] = a
+
+    return selected
+
+
+class History:
+    """Samples of one file which grow with every read() by the samples appended since the last one.
+
+    Subclasses implement _read_new() and return (times, values) of the new samples only, so a
+    rerun of the UI costs the new samples and not the whole history. The downsampled chart is
+    cached until new samples arrive.
+    """
+
+    def __init__(self, path):
+        self.path = path
+        self.times = np.empty(0, dtype=np.int64)
+        self.values = np.empty(0, dtype=np.float64)
+        self._chart = None
+        self._chart_points = 0
+        self._lock = threading.Lock()  # streamlit reruns sessions in parallel threads
+
+    def read(self):
+        """Append the new samples of the file, returns their number."""
+        with self._lock:
+            times, values = self._read_new()
+            if len(values) == 0:
+                return 0
+
+            self.times = np.concatenate((self.times, times))[-HISTORY_LIMIT:]
+            self.values = np.concatenate((self.values, values))[-HISTORY_LIMIT:]
+            self._chart = None
+            return len(values)
+
+    def chart(self, points, column):
+        """DataFrame with at most points samples of the history for st.line_chart()."""
+        with self._lock:
+            if self._chart is None or self._chart_points != points:
+                selected = lttb(self.times.astype(np.float64), self.values, points)
+                self._chart = pd.DataFrame({column: self.values[selected]}, index=self._index(self.times[selected]))
+                self._chart_points = points
+            return self._chart.copy()
+
+    def _index(self, times):
+        return times
+
+    def _read_new(self):
+        raise NotImplementedError
+
+
+class FreqLogHistory(History):
+    """Frequency ring log of the controller, only the records after the last seen sequence are read."""
+
+    def __init__(self, path):
+        super().__init__(path)
+        self.sequence = 0
+
+    def _read_new(self):
+        with open(self.path, "rb") as file:
+            magic, version, record_size, capacity, _, sequence = \
+                FREQ_LOG_HEADER.unpack(file.read(FREQ_LOG_HEADER.size))
+            if magic != FREQ_LOG_MAGIC or version != FREQ_LOG_VERSION or record_size != FREQ_LOG_RECORD.itemsize:
+                raise ValueError("unknown frequency log format")
+
+            # a new log (controller restarted with a fresh file) starts again
+            if sequence < self.sequence:
+                self.sequence = 0
+                self.times = self.times[:0]
+                self.values = self.values[:0]
+
+            # record n is in slot n % capacity, the slot after the newest may be written right now
+            first = max(self.sequence, sequence - (capacity - 1))
+            if first == sequence:
+                return self.times[:0], self.values[:0]
+
+            ring = np.memmap(file, FREQ_LOG_RECORD, "r", FREQ_LOG_HEADER.size, (capacity,))
+            records = np.array(ring[np.arange(first, sequence) % capacity])
+
+            # drop records which the writer overwrote (or started to) while they were copied
+            file.seek(0)
+            sequence_after = FREQ_LOG_HEADER.unpack(file.read(FREQ_LOG_HEADER.size))[5]
+            lost = min(max(sequence_after - (capacity - 1) - first, 0), len(records))
+            records = records[lost:]
+
+        self.sequence = sequence
+        return records["time"], records["freq"]
+
+    def _index(self, times):
+        return pd.to_datetime(times, unit="ms")
+
+
+class CsvHistory(History):
+    """Single column CSV with a header line, only the complete lines after the last read offset are parsed."""
+
+    def __init__(self, path):
+        super().__init__(path)
+        self.offset = 0
+        self.count = 0  # samples read so far, the time axis of the chart
+
+    def _read_new(self):
+        with open(self.path, "rb") as file:
+            if os.fstat(file.fileno()).st_size < self.offset:
+                # truncated or replaced, start again
+                self.offset = 0
+                self.count = 0
+                self.times = self.times[:0]
+                self.values = self.values[:0]
+
+            file.seek(self.offset)
+            data = file.read()
+
+        if self.offset == 0:
+            header_end = data.find(b"\n") + 1
+            if header_end == 0:
+                return self.times[:0], self.values[:0]
+            data = data[header_end:]
+            self.offset = header_end
+
+        # a line which is still being written is read with the next call
+        end = data.rfind(b"\n") + 1
+        values = np.array(data[:end].split(), dtype=np.float64)
+        self.offset += end
+
+        times = np.arange(self.count, self.count + len(values), dtype=np.int64)
+        self.count += len(values)
+        return times, values
+
+
+class Series:
+    """Reader of a long-term series with raw, per minute and per hour tiers.
+
+    query() finds the start of the range by binary search in the ring of the tier and only reads
+    the points of the range, so months of history cost as much as the few hundred points shown.
+    """
+
+    RAW, MINUTE, HOUR = range(3)
+
+    def __init__(self, path):
+        self.path = path
+
+    def _tiers(self, file):
+        header = SERIES_HEADER.unpack(file.read(SERIES_HEADER.size))
+        magic, version, point_size, tier_count = header[:4]
+        if magic != SERIES_MAGIC or version != SERIES_VERSION or point_size != SERIES_POINT.itemsize:
+            raise ValueError("unknown series format")
+        return [SERIES_TIER.unpack(file.read(SERIES_TIER.size)) for _ in range(tier_count)]
+
+    def query(self, tier, start, end):
+        """DataFrame with min, avg and max of the points of tier in [start, end) (unix ms), indexed by time."""
+        with open(self.path, "rb") as file:
+            tiers = self._tiers(file)
+            resolution, capacity, first, _, _, sequence = tiers[tier][:6]
+            base = SERIES_HEADER.size + len(tiers) * SERIES_TIER.size + first * SERIES_POINT.itemsize
+            points = np.memmap(file, SERIES_POINT, "r", base, (capacity,))
+
+            # point n of the tier is in slot n % capacity, the slot after the newest may be written right now
+            oldest = max(sequence - (capacity - 1), 0)
+
+            def lower_bound(lo, hi, time, length):
+                while lo < hi:
+                    mid = (lo + hi) // 2
+                    if points[mid % capacity]["time"] + length > time:
+                        hi = mid
+                    else:
+                        lo = mid + 1
+                return lo
+
+            # points which end after start up to the first one which starts at end
+            lo = lower_bound(oldest, sequence, start, resolution or 1)
+            hi = lower_bound(lo, sequence, end, 1)
+            selected = np.array(points[np.arange(lo, hi) % capacity])
+
+            # drop points which the writer overwrote (or started to) while they were copied
+            file.seek(0)
+            sequence = self._tiers(file)[tier][5]
+            lost = min(max(sequence - (capacity - 1) - lo, 0), len(selected))
+            selected = selected[lost:]
+
+        return pd.DataFrame({"min": selected["min"], "avg": selected["sum"] / np.maximum(selected["count"], 1),
+                             "max": selected["max"]}, index=pd.to_datetime(selected["time"], unit="ms"))
+
+
+def read_calibration(path):
+    """(arid, humid, milliliters) of a calibration file."""
+    with open(path) as file:
+        values = file.read().split()[1:4]
+    return tuple(int(value) for value in values)
+
+
+def write_calibration(path, arid, humid, milliliters):
+    """Replace the calibration file if the values changed. The file is renamed into place, so the
+    controller never reads a half written file. Returns True if it was written."""
+    try:
+        if read_calibration(path) == (arid, humid, milliliters):
+            return False
+    except (OSError, ValueError):
+        pass
+
+    directory = os.path.dirname(os.path.abspath(path))
+    fd, temp = tempfile.mkstemp(dir=directory, prefix=".calibration", suffix=".tmp")
+    try:
+        with os.fdopen(fd, "w") as file:
+            file.write("values\n{}\n{}\n{}".format(arid, humid, milliliters))
+        os.chmod(temp, 0o644)
+        os.replace(temp, path)
+    except BaseException:
+        os.unlink(temp)
+        raise
+    return True
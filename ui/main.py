@@ -1,11 +1,34 @@
 import streamlit as st
-import pandas as pd
-import csv
+import os
 import sys
-import getopt
+import glob
+
+import time
+
+from history import CsvHistory, FreqLogHistory, Series, read_calibration, write_calibration
 
 filesDirectory = "./"
 
+# points of the chart, longer histories are downsampled with LTTB
+CHART_POINTS = 1000
+
+# period of the long-term charts in days and the tier of the series which is shown for it
+PERIODS = {"Tag": (1, Series.RAW), "Woche": (7, Series.MINUTE), "Monat": (31, Series.HOUR),
+           "Jahr": (366, Series.HOUR)}
+
+
+@st.cache(allow_output_mutation=True)
+def load_history(path):
+    """One history per file and server process, kept across reruns and sessions."""
+    return FreqLogHistory(path) if path.endswith(".bin") else CsvHistory(path)
+
+
+@st.cache
+def load_calibration(path, mtime):
+    """Calibration values, read again only when the file changed."""
+    return read_calibration(path)
+
+
 if len(sys.argv) > 1:
     filesDirectory = sys.argv[1]
 
@@ -16,13 +39,24 @@ Das ist das Frontend für die Gießsteuerung im Modul Echtzheitbetriebssysteme v
 Fabian Maier und Tim Schmidt.
 """
 
-calibData = pd.read_csv(filesDirectory + "calibration.csv")
-loadedArid = calibData["values"][0]
-loadedHumid = calibData["values"][1]
-loadedMilliliter = calibData["values"][2]
+# every zone of the controller has calibration<zone>.csv and hydro<zone>.bin, the first zone has no suffix
+zones = sorted(os.path.basename(path)[len("calibration"):-len(".csv")]
+               for path in glob.glob(filesDirectory + "calibration*.csv"))
+zone = st.selectbox("Beet", zones, format_func=lambda z: z.lstrip("-") or "Standard") if len(zones) > 1 else ""
+calibrationFile = "calibration" + zone + ".csv"
+freqLogFile = "hydro" + zone + ".bin"
+
+calibrationPath = filesDirectory + calibrationFile
+loadedArid, loadedHumid, loadedMilliliter = load_calibration(calibrationPath, os.stat(calibrationPath).st_mtime)
 
-hydro_data = pd.read_csv(filesDirectory + "test-hydro.csv", sep=";")
-chart_data = pd.DataFrame(hydro_data)
+if os.path.exists(filesDirectory + freqLogFile):
+    history = load_history(filesDirectory + freqLogFile)
+else:
+    # sample data for running the UI without the controller
+    history = load_history(filesDirectory + "test-hydro.csv")
+# only the samples since the last rerun are read, the chart is cached until new ones arrive
+history.read()
+chart_data = history.chart(CHART_POINTS, "Frequenz in Hz")
 
 "## Kalibrierung"
 
@@ -48,8 +82,23 @@ milliliter = st.number_input(label="Zu gießende Menge Wasser in Milliliter, wen
                              value=loadedMilliliter,
                              step=100)
 
-with open(filesDirectory + "calibration.csv", "w") as file:
-    file.write("values\n")
-    file.write(str(arid) + "\n")
-    file.write(str(humid) + "\n")
-    file.write(str(milliliter))
+"## Langzeitverlauf"
+
+humidityFile = filesDirectory + "humidity" + zone + ".tsd"
+flowFile = filesDirectory + "flow" + zone + ".tsd"
+if os.path.exists(humidityFile):
+    period = st.selectbox("Zeitraum", list(PERIODS))
+    days, tier = PERIODS[period]
+    end = int(time.time() * 1000)
+    start = end - days * 24 * 3600 * 1000
+
+    "Feuchtigkeitswert (Minimum, Mittel und Maximum):"
+    st.line_chart(Series(humidityFile).query(tier, start, end))
+    if os.path.exists(flowFile):
+        "Gegossene Menge in Milliliter:"
+        st.line_chart(Series(flowFile).query(tier, start, end)[["avg"]])
+else:
+    "Die Steuerung hat noch keinen Langzeitverlauf geschrieben."
+
+# the controller reloads the file on every write, so it is only replaced when a value changed
+write_calibration(calibrationPath, int(arid), int(humid), int(milliliter))